@@ -0,0 +1,215 @@
+/*
+    Copyright (c) 2013 Insollo Entertainment, LLC.  All rights reserved.
+
+    Permission is hereby granted, free of charge, to any person obtaining a copy
+    of this software and associated documentation files (the "Software"),
+    to deal in the Software without restriction, including without limitation
+    the rights to use, copy, modify, merge, publish, distribute, sublicense,
+    and/or sell copies of the Software, and to permit persons to whom
+    the Software is furnished to do so, subject to the following conditions:
+
+    The above copyright notice and this permission notice shall be included
+    in all copies or substantial portions of the Software.
+
+    THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+    IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+    FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL
+    THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+    LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+    FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS
+    IN THE SOFTWARE.
+*/
+
+
+#include <stddef.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <time.h>
+
+#include "options.h"
+#include "clock.h"
+#include "format.h"
+
+/*  Benchmark of the message formatters. Every --echo format is run over
+    messages of several sizes and byte mixes, and the output is written
+    to /dev/null through the same buffered path nanocat uses, or with
+    --memory into a growing buffer that's never written anywhere  */
+
+typedef struct nc_bench_options {
+    int memory;
+    float time;
+} nc_bench_options_t;
+
+struct nc_option nc_bench_options[] = {
+    {"memory", 'm', NULL,
+     NC_OPT_INCREMENT, offsetof(nc_bench_options_t, memory), NULL,
+     0, 0, 0, "Benchmark Options", NULL,
+     "Format into memory instead of writing to /dev/null"},
+    {"time", 't', NULL,
+     NC_OPT_FLOAT, offsetof(nc_bench_options_t, time), NULL,
+     0, 0, 0, "Benchmark Options", "SEC",
+     "Run each case for SEC seconds (default 0.2)"},
+    {"help", 'h', NULL,
+     NC_OPT_HELP, 0, NULL,
+     0, 0, 0, "Generic", NULL, "This help text"},
+
+    /* Sentinel */
+    {NULL}
+    };
+
+struct nc_commandline nc_bench_cli = {
+    .short_description = "Benchmark of the nanocat message formatters",
+    .long_description = "",
+    .options = nc_bench_options,
+    .required_options = 0,
+    };
+
+struct nc_bench_format {
+    char *name;
+    enum echo_format format;
+};
+
+struct nc_bench_format nc_bench_formats[] = {
+    {"raw", NC_ECHO_RAW},
+    {"ascii", NC_ECHO_ASCII},
+    {"quoted", NC_ECHO_QUOTED},
+    {"msgpack", NC_ECHO_MSGPACK},
+    {"hex", NC_ECHO_HEX},
+    {"hexdump", NC_ECHO_HEXDUMP},
+    {"base64", NC_ECHO_BASE64},
+    {"jsonl", NC_ECHO_JSONL},
+    {NULL, 0},
+};
+
+int nc_bench_sizes[] = {16, 256, 4096, 65536, 1048576, 0};
+
+/*  Byte mixes: ``chars`` are picked at random, NULL means any byte  */
+struct nc_bench_mix {
+    char *name;
+    const char *chars;
+};
+
+struct nc_bench_mix nc_bench_mixes[] = {
+    {"printable", " !#$%&'()*+,-./0123456789:;<=>?@"
+        "ABCDEFGHIJKLMNOPQRSTUVWXYZ[]^_`abcdefghijklmnopqrstuvwxyz{|}~"},
+    {"binary", NULL},
+    {"escapes", "\"\\\n\r\t\b\f\x01\x1f\x7f"},
+    {NULL, NULL},
+};
+
+/*  Deterministic xorshift, so every run formats the same data  */
+unsigned int nc_bench_random(unsigned int *state) {
+    *state ^= *state << 13;
+    *state ^= *state >> 17;
+    *state ^= *state << 5;
+    return *state;
+}
+
+void nc_bench_fill(struct nc_bench_mix *mix, char *buf, int len) {
+    unsigned int state = 2463534242u;
+    int nchars;
+    int i;
+
+    nchars = mix->chars ? strlen(mix->chars) : 0;
+    for(i = 0; i < len; ++i) {
+        if(mix->chars) {
+            buf[i] = mix->chars[nc_bench_random(&state) % nchars];
+        } else {
+            buf[i] = nc_bench_random(&state) >> 24;
+        }
+    }
+}
+
+/*  Formats the message until ``seconds`` pass, returns number of messages.
+    The clock is checked once per about a megabyte of input  */
+unsigned long nc_bench_run(nc_bench_options_t *options,
+                           enum echo_format format,
+                           const char *buf, int len, uint64_t *elapsed)
+{
+    struct nc_outbuf memory = {NULL, NULL, 0, 0};
+    struct nc_msginfo info;
+    unsigned long count = 0;
+    uint64_t start;
+    uint64_t deadline;
+    int batch;
+    int i;
+
+    info.seq = 0;
+    if(clock_gettime(CLOCK_REALTIME, &info.received) != 0) {
+        fprintf(stderr, "Can't get current time: %s\n", strerror(errno));
+        exit(3);
+    }
+    batch = 1 + (1 << 20) / len;
+    start = nc_clock_ns();
+    deadline = start + (uint64_t)(options->time * 1000000000.0);
+    do {
+        for(i = 0; i < batch; ++i) {
+            if(options->memory) {
+                nc_format_message(&memory, format, NC_NO_DECODE,
+                                  &info, buf, len);
+                memory.len = 0;
+            } else {
+                nc_write_message(format, NC_NO_DECODE, &info, buf, len);
+            }
+            info.seq += 1;
+        }
+        count += batch;
+        *elapsed = nc_clock_ns() - start;
+    } while(start + *elapsed < deadline);
+    free(memory.data);
+    return count;
+}
+
+int main(int argc, char **argv) {
+    nc_bench_options_t options = {
+        .memory = 0,
+        .time = 0.2
+    };
+    struct nc_bench_format *format;
+    struct nc_bench_mix *mix;
+    int *size;
+    char *buf;
+    unsigned long count;
+    uint64_t elapsed;
+
+    nc_parse_options(&nc_bench_cli, &options, argc, argv);
+    nc_clock_init();
+    if(!options.memory) {
+        nc_output.stream = fopen("/dev/null", "w");
+        if(!nc_output.stream) {
+            fprintf(stderr, "Error opening file ``/dev/null'': %s\n",
+                strerror(errno));
+            exit(2);
+        }
+    }
+
+    printf("%-8s %-10s %8s %12s %10s\n",
+           "FORMAT", "MIX", "SIZE", "MSGS/S", "NS/BYTE");
+    for(size = nc_bench_sizes; *size; ++size) {
+        buf = malloc(*size);
+        if(!buf) {
+            fprintf(stderr, "Can't allocate message: %s\n", strerror(errno));
+            exit(3);
+        }
+        for(mix = nc_bench_mixes; mix->name; ++mix) {
+            nc_bench_fill(mix, buf, *size);
+            for(format = nc_bench_formats; format->name; ++format) {
+                count = nc_bench_run(&options, format->format,
+                                     buf, *size, &elapsed);
+                printf("%-8s %-10s %8d %12.0f %10.3f\n",
+                       format->name, mix->name, *size,
+                       count * 1000000000.0 / elapsed,
+                       (double)elapsed / count / *size);
+                fflush(stdout);
+            }
+        }
+        free(buf);
+    }
+
+    if(nc_output.stream) {
+        fclose(nc_output.stream);
+    }
+    return 0;
+}
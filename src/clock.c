@@ -0,0 +1,102 @@
+/*
+    Copyright (c) 2013 Insollo Entertainment, LLC.  All rights reserved.
+
+    Permission is hereby granted, free of charge, to any person obtaining a copy
+    of this software and associated documentation files (the "Software"),
+    to deal in the Software without restriction, including without limitation
+    the rights to use, copy, modify, merge, publish, distribute, sublicense,
+    and/or sell copies of the Software, and to permit persons to whom
+    the Software is furnished to do so, subject to the following conditions:
+
+    The above copyright notice and this permission notice shall be included
+    in all copies or substantial portions of the Software.
+
+    THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+    IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+    FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL
+    THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+    LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+    FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS
+    IN THE SOFTWARE.
+*/
+
+
+#include <time.h>
+#if defined(__x86_64__) || defined(__i386__)
+#include <cpuid.h>
+#define NC_HAVE_TSC
+#endif
+
+#include "clock.h"
+
+/*  Length of calibration against CLOCK_MONOTONIC. Longer is more precise
+    but delays startup, 5ms gives about 10 ppm  */
+#define NC_CLOCK_CALIBRATION_NS 5000000
+
+static int nc_use_tsc;
+static uint64_t nc_tsc_base;
+static uint64_t nc_ns_base;
+static double nc_ns_per_tick;
+
+static uint64_t nc_monotonic_ns(void) {
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000 + ts.tv_nsec;
+}
+
+#ifdef NC_HAVE_TSC
+static uint64_t nc_rdtsc(void) {
+    uint32_t lo, hi;
+
+    __asm__ __volatile__ ("rdtsc" : "=a" (lo), "=d" (hi));
+    return ((uint64_t)hi << 32) | lo;
+}
+
+/*  Only invariant TSC ticks at constant rate regardless of frequency
+    scaling and sleep states  */
+static int nc_has_invariant_tsc(void) {
+    unsigned int eax, ebx, ecx, edx;
+
+    if(!__get_cpuid(0x80000000, &eax, &ebx, &ecx, &edx) ||
+       eax < 0x80000007) {
+        return 0;
+    }
+    __get_cpuid(0x80000007, &eax, &ebx, &ecx, &edx);
+    return (edx >> 8) & 1;
+}
+#endif
+
+void nc_clock_init(void) {
+#ifdef NC_HAVE_TSC
+    uint64_t ns_start, ns_end;
+    uint64_t tsc_start, tsc_end;
+
+    if(!nc_has_invariant_tsc()) {
+        return;
+    }
+    ns_start = nc_monotonic_ns();
+    tsc_start = nc_rdtsc();
+    do {
+        ns_end = nc_monotonic_ns();
+        tsc_end = nc_rdtsc();
+    } while(ns_end - ns_start < NC_CLOCK_CALIBRATION_NS);
+    if(tsc_end <= tsc_start) {
+        return;
+    }
+    nc_ns_per_tick = (double)(ns_end - ns_start) / (tsc_end - tsc_start);
+    nc_tsc_base = tsc_end;
+    nc_ns_base = ns_end;
+    nc_use_tsc = 1;
+#endif
+}
+
+uint64_t nc_clock_ns(void) {
+#ifdef NC_HAVE_TSC
+    if(nc_use_tsc) {
+        return nc_ns_base +
+            (uint64_t)((double)(nc_rdtsc() - nc_tsc_base) * nc_ns_per_tick);
+    }
+#endif
+    return nc_monotonic_ns();
+}
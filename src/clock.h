@@ -0,0 +1,40 @@
+/*
+    Copyright (c) 2013 Insollo Entertainment, LLC.  All rights reserved.
+
+    Permission is hereby granted, free of charge, to any person obtaining a copy
+    of this software and associated documentation files (the "Software"),
+    to deal in the Software without restriction, including without limitation
+    the rights to use, copy, modify, merge, publish, distribute, sublicense,
+    and/or sell copies of the Software, and to permit persons to whom
+    the Software is furnished to do so, subject to the following conditions:
+
+    The above copyright notice and this permission notice shall be included
+    in all copies or substantial portions of the Software.
+
+    THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+    IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+    FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL
+    THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+    LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+    FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS
+    IN THE SOFTWARE.
+*/
+
+
+#ifndef NC_CLOCK_HEADER
+#define NC_CLOCK_HEADER
+
+#include <stdint.h>
+
+/*  Cheap monotonic clock for timestamping every message. On x86 with
+    invariant TSC it reads the time stamp counter and converts it with the
+    rate calibrated against CLOCK_MONOTONIC at startup, elsewhere it falls
+    back to clock_gettime(CLOCK_MONOTONIC)  */
+
+void nc_clock_init(void);
+
+/*  Nanoseconds since an arbitrary point, nc_clock_init() must be called
+    before  */
+uint64_t nc_clock_ns(void);
+
+#endif  /* NC_CLOCK_HEADER */
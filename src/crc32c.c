@@ -0,0 +1,109 @@
+/*
+    Copyright (c) 2013 Insollo Entertainment, LLC.  All rights reserved.
+
+    Permission is hereby granted, free of charge, to any person obtaining a copy
+    of this software and associated documentation files (the "Software"),
+    to deal in the Software without restriction, including without limitation
+    the rights to use, copy, modify, merge, publish, distribute, sublicense,
+    and/or sell copies of the Software, and to permit persons to whom
+    the Software is furnished to do so, subject to the following conditions:
+
+    The above copyright notice and this permission notice shall be included
+    in all copies or substantial portions of the Software.
+
+    THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+    IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+    FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL
+    THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+    LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+    FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS
+    IN THE SOFTWARE.
+*/
+
+
+#include <string.h>
+#if defined(__GNUC__) && defined(__x86_64__)
+#define NC_CRC32C_SSE42
+#include <nmmintrin.h>
+#endif
+
+#include "crc32c.h"
+
+#define NC_CRC32C_POLY 0x82f63b78u  /*  reflected  */
+
+static uint32_t nc_crc32c_table[8][256];
+static uint32_t (*nc_crc32c_impl)(uint32_t crc, const unsigned char *src,
+                                  int len);
+
+static uint32_t nc_crc32c_sw(uint32_t crc, const unsigned char *src, int len)
+{
+    for(; len >= 8; src += 8, len -= 8) {
+        crc ^= (uint32_t)src[0] | (uint32_t)src[1] << 8 |
+               (uint32_t)src[2] << 16 | (uint32_t)src[3] << 24;
+        crc = nc_crc32c_table[7][crc & 0xff] ^
+              nc_crc32c_table[6][(crc >> 8) & 0xff] ^
+              nc_crc32c_table[5][(crc >> 16) & 0xff] ^
+              nc_crc32c_table[4][crc >> 24] ^
+              nc_crc32c_table[3][src[4]] ^
+              nc_crc32c_table[2][src[5]] ^
+              nc_crc32c_table[1][src[6]] ^
+              nc_crc32c_table[0][src[7]];
+    }
+    for(; len > 0; ++src, --len) {
+        crc = nc_crc32c_table[0][(crc ^ *src) & 0xff] ^ (crc >> 8);
+    }
+    return crc;
+}
+
+#ifdef NC_CRC32C_SSE42
+/*  Built for SSE4.2 regardless of compiler flags, only called when the CPU
+    supports it  */
+__attribute__((target("sse4.2")))
+static uint32_t nc_crc32c_hw(uint32_t crc, const unsigned char *src, int len)
+{
+    uint64_t crc64 = crc;
+    uint64_t word;
+
+    for(; len >= 8; src += 8, len -= 8) {
+        memcpy(&word, src, 8);
+        crc64 = _mm_crc32_u64(crc64, word);
+    }
+    crc = (uint32_t)crc64;
+    for(; len > 0; ++src, --len) {
+        crc = _mm_crc32_u8(crc, *src);
+    }
+    return crc;
+}
+#endif
+
+void nc_crc32c_init(void) {
+    uint32_t crc;
+    int i;
+    int j;
+
+    for(i = 0; i < 256; ++i) {
+        crc = i;
+        for(j = 0; j < 8; ++j) {
+            crc = crc & 1 ? (crc >> 1) ^ NC_CRC32C_POLY : crc >> 1;
+        }
+        nc_crc32c_table[0][i] = crc;
+    }
+    for(i = 0; i < 256; ++i) {
+        crc = nc_crc32c_table[0][i];
+        for(j = 1; j < 8; ++j) {
+            crc = nc_crc32c_table[0][crc & 0xff] ^ (crc >> 8);
+            nc_crc32c_table[j][i] = crc;
+        }
+    }
+    nc_crc32c_impl = nc_crc32c_sw;
+#ifdef NC_CRC32C_SSE42
+    __builtin_cpu_init();
+    if(__builtin_cpu_supports("sse4.2")) {
+        nc_crc32c_impl = nc_crc32c_hw;
+    }
+#endif
+}
+
+uint32_t nc_crc32c(const char *data, int len) {
+    return ~nc_crc32c_impl(0xffffffffu, (const unsigned char *)data, len);
+}
@@ -0,0 +1,35 @@
+/*
+    Copyright (c) 2013 Insollo Entertainment, LLC.  All rights reserved.
+
+    Permission is hereby granted, free of charge, to any person obtaining a copy
+    of this software and associated documentation files (the "Software"),
+    to deal in the Software without restriction, including without limitation
+    the rights to use, copy, modify, merge, publish, distribute, sublicense,
+    and/or sell copies of the Software, and to permit persons to whom
+    the Software is furnished to do so, subject to the following conditions:
+
+    The above copyright notice and this permission notice shall be included
+    in all copies or substantial portions of the Software.
+
+    THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+    IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+    FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL
+    THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+    LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+    FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS
+    IN THE SOFTWARE.
+*/
+
+
+#ifndef NC_CRC32C_HEADER
+#define NC_CRC32C_HEADER
+
+#include <stdint.h>
+
+/*  CRC32C (Castagnoli), the checksum of iSCSI and SCTP. Uses the SSE4.2
+    crc32 instruction when the CPU has it, and slicing-by-8 tables
+    otherwise. nc_crc32c_init() must be called before any threads start  */
+void nc_crc32c_init(void);
+uint32_t nc_crc32c(const char *data, int len);
+
+#endif  /* NC_CRC32C_HEADER */
@@ -0,0 +1,128 @@
+/*
+    Copyright (c) 2013 Insollo Entertainment, LLC.  All rights reserved.
+
+    Permission is hereby granted, free of charge, to any person obtaining a copy
+    of this software and associated documentation files (the "Software"),
+    to deal in the Software without restriction, including without limitation
+    the rights to use, copy, modify, merge, publish, distribute, sublicense,
+    and/or sell copies of the Software, and to permit persons to whom
+    the Software is furnished to do so, subject to the following conditions:
+
+    The above copyright notice and this permission notice shall be included
+    in all copies or substantial portions of the Software.
+
+    THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+    IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+    FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL
+    THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+    LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+    FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS
+    IN THE SOFTWARE.
+*/
+
+
+#include <stdlib.h>
+
+#include "dedup.h"
+
+struct nc_dedup {
+    uint64_t *table;  /*  hashes, zero is an empty slot  */
+    uint64_t mask;
+    uint64_t *order;  /*  ring of hashes in the order they were added  */
+    uint64_t *times;  /*  when every hash in ``order`` was added  */
+    long window;
+    long head;
+    long count;
+    uint64_t max_age;
+};
+
+struct nc_dedup *nc_dedup_new(long window, uint64_t max_age) {
+    struct nc_dedup *dedup;
+    uint64_t size;
+
+    dedup = calloc(1, sizeof(struct nc_dedup));
+    if(!dedup) {
+        return NULL;
+    }
+    size = 16;
+    while(size < (uint64_t)window * 2) {
+        size *= 2;
+    }
+    dedup->table = calloc(size, sizeof(uint64_t));
+    dedup->order = malloc(window * sizeof(uint64_t));
+    dedup->times = malloc(window * sizeof(uint64_t));
+    if(!dedup->table || !dedup->order || !dedup->times) {
+        nc_dedup_free(dedup);
+        return NULL;
+    }
+    dedup->mask = size - 1;
+    dedup->window = window;
+    dedup->max_age = max_age;
+    return dedup;
+}
+
+void nc_dedup_free(struct nc_dedup *dedup) {
+    free(dedup->table);
+    free(dedup->order);
+    free(dedup->times);
+    free(dedup);
+}
+
+/*  Deletes the oldest hash. Entries after it in the probe sequence are
+    shifted back, so no tombstones are needed and lookups stay short  */
+static void nc_dedup_pop(struct nc_dedup *dedup) {
+    uint64_t hash;
+    uint64_t home;
+    uint64_t i;
+    uint64_t j;
+
+    hash = dedup->order[dedup->head];
+    dedup->head = (dedup->head + 1) % dedup->window;
+    dedup->count -= 1;
+
+    for(i = hash & dedup->mask; dedup->table[i] != hash;
+        i = (i + 1) & dedup->mask) {
+    }
+    for(j = (i + 1) & dedup->mask; dedup->table[j];
+        j = (j + 1) & dedup->mask) {
+        /*  Entry may move to the hole unless its home slot is
+            cyclically within (i, j]  */
+        home = dedup->table[j] & dedup->mask;
+        if(i <= j ? (home <= i || home > j) : (home <= i && home > j)) {
+            dedup->table[i] = dedup->table[j];
+            i = j;
+        }
+    }
+    dedup->table[i] = 0;
+}
+
+int nc_dedup_seen(struct nc_dedup *dedup, uint64_t hash, uint64_t now) {
+    uint64_t i;
+    long tail;
+
+    if(!hash) {
+        hash = 1;  /*  zero marks empty slots  */
+    }
+    while(dedup->count && dedup->max_age &&
+          now - dedup->times[dedup->head] > dedup->max_age) {
+        nc_dedup_pop(dedup);
+    }
+    for(i = hash & dedup->mask; dedup->table[i]; i = (i + 1) & dedup->mask) {
+        if(dedup->table[i] == hash) {
+            return 1;
+        }
+    }
+
+    if(dedup->count == dedup->window) {
+        nc_dedup_pop(dedup);
+        for(i = hash & dedup->mask; dedup->table[i];
+            i = (i + 1) & dedup->mask) {
+        }
+    }
+    dedup->table[i] = hash;
+    tail = (dedup->head + dedup->count) % dedup->window;
+    dedup->order[tail] = hash;
+    dedup->times[tail] = now;
+    dedup->count += 1;
+    return 0;
+}
@@ -0,0 +1,45 @@
+/*
+    Copyright (c) 2013 Insollo Entertainment, LLC.  All rights reserved.
+
+    Permission is hereby granted, free of charge, to any person obtaining a copy
+    of this software and associated documentation files (the "Software"),
+    to deal in the Software without restriction, including without limitation
+    the rights to use, copy, modify, merge, publish, distribute, sublicense,
+    and/or sell copies of the Software, and to permit persons to whom
+    the Software is furnished to do so, subject to the following conditions:
+
+    The above copyright notice and this permission notice shall be included
+    in all copies or substantial portions of the Software.
+
+    THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+    IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+    FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL
+    THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+    LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+    FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS
+    IN THE SOFTWARE.
+*/
+
+
+
+#ifndef NC_DEDUP_HEADER
+#define NC_DEDUP_HEADER
+
+#include <stdint.h>
+
+/*  Set of hashes of the last ``window`` messages, optionally only those
+    not older than ``max_age``. It's an open-addressing table with linear
+    probing, at most half full, plus a ring of the hashes in the order
+    they were added, to know which one to delete next. All memory is
+    allocated upfront  */
+struct nc_dedup;
+
+/*  Returns NULL if out of memory, ``max_age`` of zero means no limit  */
+struct nc_dedup *nc_dedup_new(long window, uint64_t max_age);
+void nc_dedup_free(struct nc_dedup *dedup);
+
+/*  Returns non-zero if the hash is in the set, otherwise adds it. ``now``
+    is in the same units as ``max_age``  */
+int nc_dedup_seen(struct nc_dedup *dedup, uint64_t hash, uint64_t now);
+
+#endif  /* NC_DEDUP_HEADER */
@@ -0,0 +1,782 @@
+/*
+    Copyright (c) 2013 Insollo Entertainment, LLC.  All rights reserved.
+
+    Permission is hereby granted, free of charge, to any person obtaining a copy
+    of this software and associated documentation files (the "Software"),
+    to deal in the Software without restriction, including without limitation
+    the rights to use, copy, modify, merge, publish, distribute, sublicense,
+    and/or sell copies of the Software, and to permit persons to whom
+    the Software is furnished to do so, subject to the following conditions:
+
+    The above copyright notice and this permission notice shall be included
+    in all copies or substantial portions of the Software.
+
+    THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+    IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+    FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL
+    THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+    LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+    FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS
+    IN THE SOFTWARE.
+*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <errno.h>
+#include <unistd.h>
+#include <poll.h>
+#include <sys/uio.h>
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
+
+#include "format.h"
+
+typedef char *(*nc_encoder_t)(char *dst, const unsigned char *src, int len);
+
+struct nc_sink nc_output;
+char nc_output_data[NC_OUTBUF_SIZE];
+struct nc_outbuf nc_output_buf = {&nc_output, nc_output_data,
+                                  0, NC_OUTBUF_SIZE};
+
+static const char nc_hex_digits[] = "0123456789abcdef";
+static const char nc_base64_alphabet[] =
+    "ABCDEFGHIJKLMNOPQRSTUVWXYZabcdefghijklmnopqrstuvwxyz0123456789+/";
+
+void nc_sink_write(struct nc_sink *sink, const char *data, int len) {
+    if(sink->file) {
+        nc_filewriter_put(sink->file, data, len);
+    } else {
+        fwrite(data, 1, len, sink->stream);
+    }
+}
+
+/*  Waits until a non-blocking descriptor is writable  */
+static void nc_sink_wait(int fd) {
+    struct pollfd pfd;
+    int rc;
+
+    pfd.fd = fd;
+    pfd.events = POLLOUT;
+    do {
+        rc = poll(&pfd, 1, -1);
+    } while(rc < 0 && errno == EINTR);
+}
+
+/*  Writes ``head`` followed by ``data`` with a single writev() on the
+    stream's descriptor, bypassing stdio, so a large message is written
+    straight from the receive buffer instead of being copied  */
+void nc_sink_writev(struct nc_sink *sink, const char *head, int headlen,
+                    const char *data, int len)
+{
+    struct iovec iov[2];
+    struct iovec *cur;
+    int count;
+    ssize_t rc;
+
+    if(sink->file) {
+        nc_filewriter_put(sink->file, head, headlen);
+        nc_filewriter_put(sink->file, data, len);
+        return;
+    }
+    fflush(sink->stream);
+    iov[0].iov_base = (void *)head;
+    iov[0].iov_len = headlen;
+    iov[1].iov_base = (void *)data;
+    iov[1].iov_len = len;
+    cur = headlen ? iov : iov + 1;
+    count = headlen ? 2 : 1;
+    while(count) {
+        rc = writev(fileno(sink->stream), cur, count);
+        if(rc < 0) {
+            if(errno == EINTR) {
+                continue;
+            }
+            if(errno == EAGAIN || errno == EWOULDBLOCK) {
+                /*  Non-blocking stdout, e.g. shared with a parent  */
+                nc_sink_wait(fileno(sink->stream));
+                continue;
+            }
+            fprintf(stderr, "Can't write output: %s\n", strerror(errno));
+            exit(3);
+        }
+        while(count && (size_t)rc >= cur->iov_len) {
+            rc -= cur->iov_len;
+            ++cur;
+            --count;
+        }
+        if(count) {
+            cur->iov_base = (char *)cur->iov_base + rc;
+            cur->iov_len -= rc;
+        }
+    }
+}
+
+/*  Marks the end of a complete message, files are rotated only there  */
+void nc_sink_message_end(struct nc_sink *sink) {
+    if(sink->file) {
+        nc_filewriter_message_end(sink->file);
+    }
+}
+
+void nc_sink_flush(struct nc_sink *sink) {
+    if(sink->stream) {
+        fflush(sink->stream);
+    }
+}
+
+void nc_out_flush(struct nc_outbuf *out) {
+    if(out->len) {
+        nc_sink_write(out->sink, out->data, out->len);
+        out->len = 0;
+    }
+}
+
+/*  Returns pointer to at least ``size`` bytes of free space in the buffer,
+    for buffer with a sink ``size`` must not exceed its size  */
+char *nc_out_reserve(struct nc_outbuf *out, int size) {
+    int newsize;
+
+    if(out->len + size > out->size) {
+        if(out->sink) {
+            nc_out_flush(out);
+        } else {
+            newsize = out->size ? out->size : 256;
+            while(newsize < out->len + size) {
+                newsize *= 2;
+            }
+            out->data = realloc(out->data, newsize);
+            if(!out->data) {
+                fprintf(stderr, "Can't grow output buffer\n");
+                abort();
+            }
+            out->size = newsize;
+        }
+    }
+    return out->data + out->len;
+}
+
+void nc_out_write(struct nc_outbuf *out, const char *data, int len) {
+    if(out->sink && out->len + len > out->size) {
+        if(len > out->size) {
+            /*  Too big to be worth copying, what's buffered (e.g. msgpack
+                header) goes out in the same system call  */
+            nc_sink_writev(out->sink, out->data, out->len, data, len);
+            out->len = 0;
+            return;
+        }
+        nc_out_flush(out);
+    }
+    memcpy(nc_out_reserve(out, len), data, len);
+    out->len += len;
+}
+
+void nc_out_putc(struct nc_outbuf *out, char c) {
+    *nc_out_reserve(out, 1) = c;
+    out->len += 1;
+}
+
+/*  Feeds ``buf`` to the encoder in chunks, encoder must produce at most
+    ``ratio`` output bytes per input byte plus 4 bytes of padding. Chunks
+    are multiple of 3 bytes long, so base64 is not padded in the middle  */
+static void nc_out_encode(struct nc_outbuf *out, nc_encoder_t encoder,
+                          const char *buf, int buflen, int ratio)
+{
+    int chunk;
+    int n;
+    char *dst;
+
+    chunk = (NC_OUTBUF_SIZE - 4) / ratio / 3 * 3;
+    while(buflen > 0) {
+        n = buflen < chunk ? buflen : chunk;
+        dst = nc_out_reserve(out, n * ratio + 4);
+        out->len = encoder(dst, (const unsigned char *)buf, n) - out->data;
+        buf += n;
+        buflen -= n;
+    }
+}
+
+static int nc_isprint(unsigned char c) {
+    return c >= 0x20 && c < 0x7f;
+}
+
+static char *nc_encode_ascii(char *dst, const unsigned char *src, int len)
+{
+    for(; len > 0; --len, ++src) {
+        *dst++ = nc_isprint(*src) ? *src : '.';
+    }
+    return dst;
+}
+
+static char *nc_encode_quoted(char *dst, const unsigned char *src, int len)
+{
+    for(; len > 0; --len, ++src) {
+        switch(*src) {
+        case '\n':
+            *dst++ = '\\';
+            *dst++ = 'n';
+            break;
+        case '\r':
+            *dst++ = '\\';
+            *dst++ = 'r';
+            break;
+        case '\\':
+        case '\"':
+            *dst++ = '\\';
+            *dst++ = *src;
+            break;
+        default:
+            if(nc_isprint(*src)) {
+                *dst++ = *src;
+            } else {
+                *dst++ = '\\';
+                *dst++ = 'x';
+                *dst++ = nc_hex_digits[*src >> 4];
+                *dst++ = nc_hex_digits[*src & 0xf];
+            }
+        }
+    }
+    return dst;
+}
+
+#ifdef __SSE2__
+/*  Converts 16 nibbles to their lowercase hex digits  */
+static __m128i nc_hex_digits_sse2(__m128i nibbles) {
+    __m128i letters;
+
+    letters = _mm_cmpgt_epi8(nibbles, _mm_set1_epi8(9));
+    letters = _mm_and_si128(letters, _mm_set1_epi8('a' - '0' - 10));
+    return _mm_add_epi8(_mm_add_epi8(nibbles, _mm_set1_epi8('0')), letters);
+}
+#endif
+
+static char *nc_encode_hex(char *dst, const unsigned char *src, int len) {
+#ifdef __SSE2__
+    __m128i mask, bytes, high, low;
+
+    mask = _mm_set1_epi8(0xf);
+    for(; len >= 16; len -= 16, src += 16, dst += 32) {
+        bytes = _mm_loadu_si128((const __m128i *)src);
+        high = _mm_and_si128(_mm_srli_epi16(bytes, 4), mask);
+        low = _mm_and_si128(bytes, mask);
+        _mm_storeu_si128((__m128i *)dst,
+            nc_hex_digits_sse2(_mm_unpacklo_epi8(high, low)));
+        _mm_storeu_si128((__m128i *)(dst + 16),
+            nc_hex_digits_sse2(_mm_unpackhi_epi8(high, low)));
+    }
+#endif
+    for(; len > 0; --len, ++src) {
+        *dst++ = nc_hex_digits[*src >> 4];
+        *dst++ = nc_hex_digits[*src & 0xf];
+    }
+    return dst;
+}
+
+static char *nc_encode_base64(char *dst, const unsigned char *src, int len)
+{
+    unsigned long triple;
+
+    for(; len >= 3; len -= 3, src += 3, dst += 4) {
+        triple = ((unsigned long)src[0] << 16) | (src[1] << 8) | src[2];
+        dst[0] = nc_base64_alphabet[triple >> 18];
+        dst[1] = nc_base64_alphabet[(triple >> 12) & 0x3f];
+        dst[2] = nc_base64_alphabet[(triple >> 6) & 0x3f];
+        dst[3] = nc_base64_alphabet[triple & 0x3f];
+    }
+    if(len) {
+        triple = (unsigned long)src[0] << 16;
+        if(len == 2) {
+            triple |= src[1] << 8;
+        }
+        *dst++ = nc_base64_alphabet[triple >> 18];
+        *dst++ = nc_base64_alphabet[(triple >> 12) & 0x3f];
+        *dst++ = len == 2 ? nc_base64_alphabet[(triple >> 6) & 0x3f] : '=';
+        *dst++ = '=';
+    }
+    return dst;
+}
+
+/*  Escapes string for JSON, every byte takes at most 6 bytes of output.
+    Bytes >= 0x80 are copied as is, so input must be valid UTF-8  */
+static char *nc_encode_json(char *dst, const unsigned char *src, int len) {
+    for(; len > 0; --len, ++src) {
+        if(*src >= 0x20 && *src != '"' && *src != '\\') {
+            *dst++ = *src;
+            continue;
+        }
+        *dst++ = '\\';
+        switch(*src) {
+        case '"':
+        case '\\':
+            *dst++ = *src;
+            break;
+        case '\n':
+            *dst++ = 'n';
+            break;
+        case '\r':
+            *dst++ = 'r';
+            break;
+        case '\t':
+            *dst++ = 't';
+            break;
+        default:
+            *dst++ = 'u';
+            *dst++ = '0';
+            *dst++ = '0';
+            *dst++ = nc_hex_digits[*src >> 4];
+            *dst++ = nc_hex_digits[*src & 0xf];
+        }
+    }
+    return dst;
+}
+
+/*  Checks that data is well-formed UTF-8 (no overlong forms, surrogates or
+    code points above U+10FFFF)  */
+static int nc_is_utf8(const unsigned char *src, int len) {
+    const unsigned char *end = src + len;
+    int follow;
+    unsigned char c;
+
+    while(src < end) {
+        c = *src++;
+        if(c < 0x80) {
+            continue;
+        } else if(c >= 0xc2 && c <= 0xdf) {
+            follow = 1;
+        } else if(c >= 0xe0 && c <= 0xef) {
+            follow = 2;
+        } else if(c >= 0xf0 && c <= 0xf4) {
+            follow = 3;
+        } else {
+            return 0;
+        }
+        if(end - src < follow) {
+            return 0;
+        }
+        if((c == 0xe0 && src[0] < 0xa0) || (c == 0xed && src[0] > 0x9f) ||
+           (c == 0xf0 && src[0] < 0x90) || (c == 0xf4 && src[0] > 0x8f)) {
+            return 0;
+        }
+        for(; follow > 0; --follow, ++src) {
+            if((*src & 0xc0) != 0x80) {
+                return 0;
+            }
+        }
+    }
+    return 1;
+}
+
+/*  Formats up to 16 bytes the same way ``hexdump -C`` does. The line is
+    at most 79 bytes long  */
+static char *nc_encode_hexdump_line(char *dst, unsigned long offset,
+                                    const unsigned char *src, int len)
+{
+    int i;
+
+    for(i = 7; i >= 0; --i, offset >>= 4) {
+        dst[i] = nc_hex_digits[offset & 0xf];
+    }
+    dst += 8;
+    *dst++ = ' ';
+    for(i = 0; i < 16; ++i) {
+        if(i == 0 || i == 8) {
+            *dst++ = ' ';
+        }
+        if(i < len) {
+            *dst++ = nc_hex_digits[src[i] >> 4];
+            *dst++ = nc_hex_digits[src[i] & 0xf];
+        } else {
+            *dst++ = ' ';
+            *dst++ = ' ';
+        }
+        *dst++ = ' ';
+    }
+    *dst++ = ' ';
+    *dst++ = '|';
+    dst = nc_encode_ascii(dst, src, len);
+    *dst++ = '|';
+    *dst++ = '\n';
+    return dst;
+}
+
+static void nc_format_hexdump(struct nc_outbuf *out,
+                              const char *buf, int buflen)
+{
+    int offset;
+    int n;
+    char *dst;
+
+    if(!buflen) {
+        return;  /*  Like ``hexdump -C`` of empty input  */
+    }
+    for(offset = 0; offset < buflen; offset += 16) {
+        n = buflen - offset < 16 ? buflen - offset : 16;
+        dst = nc_out_reserve(out, 80);
+        out->len = nc_encode_hexdump_line(dst, offset,
+            (const unsigned char *)buf + offset, n) - out->data;
+    }
+    dst = nc_out_reserve(out, 9);
+    for(n = 7, offset = buflen; n >= 0; --n, offset >>= 4) {
+        dst[n] = nc_hex_digits[offset & 0xf];
+    }
+    dst[8] = '\n';
+    out->len += 9;
+}
+
+/*  Maximum nesting of msgpack containers that can be decoded  */
+#define NC_MSGPACK_MAXDEPTH 64
+
+enum nc_msgpack_kind {
+    NC_MSGPACK_SCALAR,
+    NC_MSGPACK_STR,
+    NC_MSGPACK_BIN,
+    NC_MSGPACK_EXT,
+    NC_MSGPACK_ARRAY,
+    NC_MSGPACK_MAP
+};
+
+struct nc_msgpack_frame {
+    unsigned long long items;  /*  keys and values are counted separately  */
+    unsigned long long done;
+    int is_map;
+};
+
+unsigned long long nc_get_be(const unsigned char *src, int len) {
+    unsigned long long value = 0;
+
+    for(; len > 0; --len, ++src) {
+        value = (value << 8) | *src;
+    }
+    return value;
+}
+
+/*  Output helper for nc_msgpack_to_json, NULL ``out`` means validation  */
+static void nc_msgpack_write(struct nc_outbuf *out, const char *data, int len)
+{
+    if(out) {
+        nc_out_write(out, data, len);
+    }
+}
+
+/*  Walks exactly one msgpack object in ``buf`` and renders it as compact JSON
+    into ``out``. Parser keeps its state in a fixed-size stack and never
+    allocates. When ``out`` is NULL it only checks that the object is
+    well-formed and representable in JSON (strings are UTF-8, map keys are
+    scalars), so that nothing is written for an object that later turns out
+    to be broken. Returns non-zero on success.
+
+    Binary strings are rendered as base64 strings, extension types as
+    {"ext":TYPE,"data":"BASE64"}, and non-string map keys are quoted  */
+static int nc_msgpack_to_json(struct nc_outbuf *out,
+                              const char *buf, int buflen)
+{
+    struct nc_msgpack_frame stack[NC_MSGPACK_MAXDEPTH];
+    struct nc_msgpack_frame *top;
+    const unsigned char *src = (const unsigned char *)buf;
+    const unsigned char *end = src + buflen;
+    enum nc_msgpack_kind kind;
+    unsigned long long len;
+    long long ival;
+    union { uint32_t u; float f; } f32;
+    union { uint64_t u; double d; } f64;
+    char scalar[32];
+    int scalar_len;
+    int depth = 0;
+    int is_key;
+    int ext_type = 0;
+    int c, n;
+
+    do {
+        if(src >= end) {
+            return 0;
+        }
+        top = depth ? &stack[depth-1] : NULL;
+        is_key = top && top->is_map && top->done % 2 == 0;
+        if(top && top->is_map && !is_key) {
+            nc_msgpack_write(out, ":", 1);
+        } else if(top && top->done) {
+            nc_msgpack_write(out, ",", 1);
+        }
+
+        c = *src++;
+        kind = NC_MSGPACK_SCALAR;
+        n = 0;  /*  size of the big-endian length or value that follows  */
+        scalar_len = 0;
+        if(c <= 0x7f) {
+            scalar_len = sprintf(scalar, "%d", c);
+        } else if(c >= 0xe0) {
+            scalar_len = sprintf(scalar, "%d", c - 0x100);
+        } else if(c <= 0x8f) {
+            kind = NC_MSGPACK_MAP;
+            len = c & 0x0f;
+        } else if(c <= 0x9f) {
+            kind = NC_MSGPACK_ARRAY;
+            len = c & 0x0f;
+        } else if(c <= 0xbf) {
+            kind = NC_MSGPACK_STR;
+            len = c & 0x1f;
+        } else if(c == 0xc0) {
+            scalar_len = sprintf(scalar, "null");
+        } else if(c == 0xc2) {
+            scalar_len = sprintf(scalar, "false");
+        } else if(c == 0xc3) {
+            scalar_len = sprintf(scalar, "true");
+        } else if(c >= 0xc4 && c <= 0xc6) {
+            kind = NC_MSGPACK_BIN;
+            n = 1 << (c - 0xc4);
+        } else if(c >= 0xc7 && c <= 0xc9) {
+            kind = NC_MSGPACK_EXT;
+            n = 1 << (c - 0xc7);
+        } else if(c == 0xca || c == 0xcb) {
+            n = c == 0xca ? 4 : 8;
+        } else if(c >= 0xcc && c <= 0xd3) {
+            n = 1 << ((c - 0xcc) & 3);
+        } else if(c >= 0xd4 && c <= 0xd8) {
+            kind = NC_MSGPACK_EXT;
+            len = 1 << (c - 0xd4);
+        } else if(c >= 0xd9 && c <= 0xdb) {
+            kind = NC_MSGPACK_STR;
+            n = 1 << (c - 0xd9);
+        } else if(c == 0xdc || c == 0xdd) {
+            kind = NC_MSGPACK_ARRAY;
+            n = c == 0xdc ? 2 : 4;
+        } else if(c == 0xde || c == 0xdf) {
+            kind = NC_MSGPACK_MAP;
+            n = c == 0xde ? 2 : 4;
+        } else {
+            return 0;  /*  0xc1 is never used  */
+        }
+
+        if(n) {
+            if(end - src < n) {
+                return 0;
+            }
+            len = nc_get_be(src, n);
+            src += n;
+        }
+        if(kind == NC_MSGPACK_SCALAR && !scalar_len) {
+            if(c == 0xca) {
+                f32.u = len;
+                f64.d = f32.f;
+            } else if(c == 0xcb) {
+                f64.u = len;
+            }
+            if(c == 0xca || c == 0xcb) {
+                if(f64.d != f64.d || f64.d - f64.d != 0) {
+                    scalar_len = sprintf(scalar, "null");  /*  NaN or Inf  */
+                } else {
+                    scalar_len = sprintf(scalar, c == 0xca ? "%.9g" : "%.17g",
+                                         f64.d);
+                }
+            } else if(c <= 0xcf) {
+                scalar_len = sprintf(scalar, "%llu", len);
+            } else {
+                if(n < 8 && (len >> (8*n - 1))) {
+                    len |= ~0ULL << (8*n);  /*  sign extension  */
+                }
+                ival = (long long)len;
+                scalar_len = sprintf(scalar, "%lld", ival);
+            }
+        }
+        if(kind == NC_MSGPACK_EXT) {
+            if(src >= end) {
+                return 0;
+            }
+            ext_type = (signed char)*src++;
+        }
+
+        switch(kind) {
+        case NC_MSGPACK_SCALAR:
+            if(is_key) {
+                nc_msgpack_write(out, "\"", 1);
+            }
+            nc_msgpack_write(out, scalar, scalar_len);
+            if(is_key) {
+                nc_msgpack_write(out, "\"", 1);
+            }
+            break;
+        case NC_MSGPACK_STR:
+        case NC_MSGPACK_BIN:
+        case NC_MSGPACK_EXT:
+            if(len > (unsigned long long)(end - src)) {
+                return 0;
+            }
+            if(kind == NC_MSGPACK_EXT) {
+                if(is_key) {
+                    return 0;
+                }
+                scalar_len = sprintf(scalar, "{\"ext\":%d,\"data\":",
+                                     ext_type);
+                nc_msgpack_write(out, scalar, scalar_len);
+            }
+            if(!out) {
+                if(kind == NC_MSGPACK_STR && !nc_is_utf8(src, len)) {
+                    return 0;
+                }
+            } else {
+                nc_out_putc(out, '"');
+                if(kind == NC_MSGPACK_STR) {
+                    nc_out_encode(out, nc_encode_json,
+                                  (const char *)src, len, 6);
+                } else {
+                    nc_out_encode(out, nc_encode_base64,
+                                  (const char *)src, len, 2);
+                }
+                nc_out_putc(out, '"');
+            }
+            if(kind == NC_MSGPACK_EXT) {
+                nc_msgpack_write(out, "}", 1);
+            }
+            src += len;
+            break;
+        case NC_MSGPACK_ARRAY:
+        case NC_MSGPACK_MAP:
+            if(kind == NC_MSGPACK_MAP) {
+                len *= 2;
+            }
+            /*  Every item takes at least a byte, that also rejects
+                absurd lengths early  */
+            if(is_key || depth == NC_MSGPACK_MAXDEPTH ||
+               len > (unsigned long long)(end - src)) {
+                return 0;
+            }
+            nc_msgpack_write(out, kind == NC_MSGPACK_MAP ? "{" : "[", 1);
+            stack[depth].items = len;
+            stack[depth].done = 0;
+            stack[depth].is_map = kind == NC_MSGPACK_MAP;
+            depth += 1;
+            break;
+        }
+
+        if(kind != NC_MSGPACK_ARRAY && kind != NC_MSGPACK_MAP && depth) {
+            stack[depth-1].done += 1;
+        }
+        while(depth && stack[depth-1].done == stack[depth-1].items) {
+            nc_msgpack_write(out, stack[depth-1].is_map ? "}" : "]", 1);
+            depth -= 1;
+            if(depth) {
+                stack[depth-1].done += 1;
+            }
+        }
+    } while(depth);
+
+    return src == end;
+}
+
+static void nc_format_decoded(struct nc_outbuf *out,
+                              const char *buf, int buflen)
+{
+    if(nc_msgpack_to_json(NULL, buf, buflen)) {
+        nc_msgpack_to_json(out, buf, buflen);
+    } else {
+        nc_out_write(out, "{\"error\":\"invalid msgpack\",\"data_base64\":\"",
+                     42);
+        nc_out_encode(out, nc_encode_base64, buf, buflen, 2);
+        nc_out_write(out, "\"}", 2);
+    }
+    nc_out_putc(out, '\n');
+}
+
+static void nc_format_jsonl(struct nc_outbuf *out, enum decode_format decode,
+                            const struct nc_msginfo *info,
+                            const char *buf, int buflen)
+{
+    char *dst;
+
+    dst = nc_out_reserve(out, 128);
+    out->len += sprintf(dst, "{\"ts\":%ld.%06ld,\"size\":%d,\"seq\":%lu,",
+                        (long)info->received.tv_sec,
+                        info->received.tv_nsec / 1000, buflen, info->seq);
+    if(decode == NC_DECODE_MSGPACK) {
+        if(nc_msgpack_to_json(NULL, buf, buflen)) {
+            nc_out_write(out, "\"data\":", 7);
+            nc_msgpack_to_json(out, buf, buflen);
+            nc_out_write(out, "}\n", 2);
+            return;
+        }
+        nc_out_write(out, "\"data_base64\":\"", 15);
+        nc_out_encode(out, nc_encode_base64, buf, buflen, 2);
+    } else if(nc_is_utf8((const unsigned char *)buf, buflen)) {
+        nc_out_write(out, "\"data\":\"", 8);
+        nc_out_encode(out, nc_encode_json, buf, buflen, 6);
+    } else {
+        nc_out_write(out, "\"data_base64\":\"", 15);
+        nc_out_encode(out, nc_encode_base64, buf, buflen, 2);
+    }
+    nc_out_write(out, "\"}\n", 3);
+}
+
+void nc_format_message(struct nc_outbuf *out, enum echo_format echo,
+                       enum decode_format decode,
+                       const struct nc_msginfo *info,
+                       const char *buf, int buflen)
+{
+    char *dst;
+
+    if(decode == NC_DECODE_MSGPACK && echo != NC_ECHO_JSONL) {
+        nc_format_decoded(out, buf, buflen);
+        return;
+    }
+
+    switch(echo) {
+    case NC_NO_ECHO:
+        break;
+    case NC_ECHO_RAW:
+        nc_out_write(out, buf, buflen);
+        break;
+    case NC_ECHO_ASCII:
+        nc_out_encode(out, nc_encode_ascii, buf, buflen, 1);
+        nc_out_putc(out, '\n');
+        break;
+    case NC_ECHO_QUOTED:
+        nc_out_putc(out, '"');
+        nc_out_encode(out, nc_encode_quoted, buf, buflen, 4);
+        nc_out_write(out, "\"\n", 2);
+        break;
+    case NC_ECHO_MSGPACK:
+        dst = nc_out_reserve(out, 5);
+        if(buflen < 256) {
+            *dst++ = '\xc4';
+            *dst++ = buflen;
+        } else if(buflen < 65536) {
+            *dst++ = '\xc5';
+            *dst++ = buflen >> 8;
+            *dst++ = buflen & 0xff;
+        } else {
+            *dst++ = '\xc6';
+            *dst++ = buflen >> 24;
+            *dst++ = (buflen >> 16) & 0xff;
+            *dst++ = (buflen >> 8) & 0xff;
+            *dst++ = buflen & 0xff;
+        }
+        out->len = dst - out->data;
+        nc_out_write(out, buf, buflen);
+        break;
+    case NC_ECHO_HEX:
+        nc_out_encode(out, nc_encode_hex, buf, buflen, 2);
+        nc_out_putc(out, '\n');
+        break;
+    case NC_ECHO_HEXDUMP:
+        nc_format_hexdump(out, buf, buflen);
+        break;
+    case NC_ECHO_BASE64:
+        nc_out_encode(out, nc_encode_base64, buf, buflen, 2);
+        nc_out_putc(out, '\n');
+        break;
+    case NC_ECHO_JSONL:
+        nc_format_jsonl(out, decode, info, buf, buflen);
+        break;
+    }
+}
+
+void nc_write_message(enum echo_format echo, enum decode_format decode,
+                      const struct nc_msginfo *info,
+                      const char *buf, int buflen)
+{
+    nc_format_message(&nc_output_buf, echo, decode, info, buf, buflen);
+    nc_out_flush(&nc_output_buf);
+    nc_sink_message_end(&nc_output);
+    nc_sink_flush(&nc_output);
+}
@@ -0,0 +1,107 @@
+/*
+    Copyright (c) 2013 Insollo Entertainment, LLC.  All rights reserved.
+
+    Permission is hereby granted, free of charge, to any person obtaining a copy
+    of this software and associated documentation files (the "Software"),
+    to deal in the Software without restriction, including without limitation
+    the rights to use, copy, modify, merge, publish, distribute, sublicense,
+    and/or sell copies of the Software, and to permit persons to whom
+    the Software is furnished to do so, subject to the following conditions:
+
+    The above copyright notice and this permission notice shall be included
+    in all copies or substantial portions of the Software.
+
+    THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+    IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+    FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL
+    THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+    LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+    FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS
+    IN THE SOFTWARE.
+*/
+
+
+#ifndef NC_FORMAT_HEADER
+#define NC_FORMAT_HEADER
+
+#include <stdio.h>
+#include <time.h>
+
+#include "output.h"
+
+/*  Message formatters, shared by nanocat and nanocat-bench  */
+
+enum echo_format {
+    NC_NO_ECHO,
+    NC_ECHO_RAW,
+    NC_ECHO_ASCII,
+    NC_ECHO_QUOTED,
+    NC_ECHO_MSGPACK,
+    NC_ECHO_HEX,
+    NC_ECHO_HEXDUMP,
+    NC_ECHO_BASE64,
+    NC_ECHO_JSONL
+};
+
+enum decode_format {
+    NC_NO_DECODE,
+    NC_DECODE_MSGPACK
+};
+
+/*  Destination of the output: stdio stream, or the --output file that is
+    written by a separate thread  */
+struct nc_sink {
+    FILE *stream;
+    struct nc_filewriter *file;
+};
+
+/*  Output buffer. Formatters encode into it directly and it's written to the
+    sink only when full or at the end of a message, so no formatter has to
+    go through stdio for every byte. Buffer without a sink grows instead,
+    that's used to format messages in other threads.  */
+#define NC_OUTBUF_SIZE 65536
+
+struct nc_outbuf {
+    struct nc_sink *sink;  /*  NULL to grow the buffer instead of flushing  */
+    char *data;
+    int len;
+    int size;
+};
+
+/*  Per-message metadata taken at receive time  */
+struct nc_msginfo {
+    unsigned long seq;
+    struct timespec received;  /*  wall-clock time, only set for --jsonl  */
+};
+
+/*  Default output: stdout or the --output file  */
+extern struct nc_sink nc_output;
+extern struct nc_outbuf nc_output_buf;
+
+void nc_sink_write(struct nc_sink *sink, const char *data, int len);
+void nc_sink_writev(struct nc_sink *sink, const char *head, int headlen,
+                    const char *data, int len);
+void nc_sink_message_end(struct nc_sink *sink);
+void nc_sink_flush(struct nc_sink *sink);
+
+void nc_out_flush(struct nc_outbuf *out);
+char *nc_out_reserve(struct nc_outbuf *out, int size);
+void nc_out_write(struct nc_outbuf *out, const char *data, int len);
+void nc_out_putc(struct nc_outbuf *out, char c);
+
+/*  Big-endian integer of ``len`` bytes  */
+unsigned long long nc_get_be(const unsigned char *src, int len);
+
+/*  Appends formatted message to ``out``  */
+void nc_format_message(struct nc_outbuf *out, enum echo_format echo,
+                       enum decode_format decode,
+                       const struct nc_msginfo *info,
+                       const char *buf, int buflen);
+
+/*  Formats the message into nc_output_buf and writes it out to nc_output
+    as a complete message  */
+void nc_write_message(enum echo_format echo, enum decode_format decode,
+                      const struct nc_msginfo *info,
+                      const char *buf, int buflen);
+
+#endif  /* NC_FORMAT_HEADER */
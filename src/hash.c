@@ -0,0 +1,58 @@
+/*
+    Copyright (c) 2013 Insollo Entertainment, LLC.  All rights reserved.
+
+    Permission is hereby granted, free of charge, to any person obtaining a copy
+    of this software and associated documentation files (the "Software"),
+    to deal in the Software without restriction, including without limitation
+    the rights to use, copy, modify, merge, publish, distribute, sublicense,
+    and/or sell copies of the Software, and to permit persons to whom
+    the Software is furnished to do so, subject to the following conditions:
+
+    The above copyright notice and this permission notice shall be included
+    in all copies or substantial portions of the Software.
+
+    THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+    IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+    FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL
+    THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+    LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+    FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS
+    IN THE SOFTWARE.
+*/
+
+
+#include <string.h>
+
+#include "hash.h"
+
+uint64_t nc_hash(const char *data, int len) {
+    const uint64_t m = 0xc6a4a7935bd1e995ULL;
+    uint64_t hash;
+    uint64_t word;
+    int i;
+
+    hash = 0x9e3779b97f4a7c15ULL ^ ((uint64_t)len * m);
+    for(i = 0; i + 8 <= len; i += 8) {
+        memcpy(&word, data + i, 8);
+        word *= m;
+        word ^= word >> 47;
+        word *= m;
+        hash ^= word;
+        hash *= m;
+    }
+    if(i < len) {
+        word = 0;
+        memcpy(&word, data + i, len - i);
+        hash ^= word;
+        hash *= m;
+    }
+
+    /*  Murmur2 leaves the high bits poorly mixed, the ring of --shard-key
+        and the table of --dedup depend on them  */
+    hash ^= hash >> 33;
+    hash *= 0xff51afd7ed558ccdULL;
+    hash ^= hash >> 33;
+    hash *= 0xc4ceb9fe1a85ec53ULL;
+    hash ^= hash >> 33;
+    return hash;
+}
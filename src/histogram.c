@@ -0,0 +1,111 @@
+/*
+    Copyright (c) 2013 Insollo Entertainment, LLC.  All rights reserved.
+
+    Permission is hereby granted, free of charge, to any person obtaining a copy
+    of this software and associated documentation files (the "Software"),
+    to deal in the Software without restriction, including without limitation
+    the rights to use, copy, modify, merge, publish, distribute, sublicense,
+    and/or sell copies of the Software, and to permit persons to whom
+    the Software is furnished to do so, subject to the following conditions:
+
+    The above copyright notice and this permission notice shall be included
+    in all copies or substantial portions of the Software.
+
+    THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+    IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+    FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL
+    THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+    LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+    FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS
+    IN THE SOFTWARE.
+*/
+
+
+#include <string.h>
+
+#include "histogram.h"
+
+static int nc_hist_index(uint64_t value) {
+    int exp;
+
+    if(value < 2*NC_HIST_SUBBUCKETS) {
+        return (int)value;
+    }
+    exp = 63 - __builtin_clzll(value);
+    return (exp - 2) * NC_HIST_SUBBUCKETS +
+        (int)((value >> (exp - 3)) - NC_HIST_SUBBUCKETS);
+}
+
+/*  Smallest value that falls into the bucket  */
+static uint64_t nc_hist_bucket_value(int index) {
+    int exp;
+
+    if(index < 2*NC_HIST_SUBBUCKETS) {
+        return index;
+    }
+    exp = index / NC_HIST_SUBBUCKETS + 2;
+    return (uint64_t)(NC_HIST_SUBBUCKETS + index % NC_HIST_SUBBUCKETS)
+        << (exp - 3);
+}
+
+void nc_hist_reset(struct nc_histogram *hist) {
+    memset(hist, 0, sizeof(struct nc_histogram));
+}
+
+void nc_hist_add(struct nc_histogram *hist, uint64_t value) {
+    if(!hist->count || value < hist->min) {
+        hist->min = value;
+    }
+    if(value > hist->max) {
+        hist->max = value;
+    }
+    hist->count += 1;
+    hist->sum += value;
+    hist->buckets[nc_hist_index(value)] += 1;
+}
+
+uint64_t nc_hist_percentile(const struct nc_histogram *hist, double percent) {
+    uint64_t rank;
+    uint64_t seen;
+    uint64_t value;
+    int i;
+
+    if(!hist->count) {
+        return 0;
+    }
+    rank = (uint64_t)(hist->count * percent / 100.0);
+    if(rank >= hist->count) {
+        return hist->max;
+    }
+    seen = 0;
+    for(i = 0; i < NC_HIST_BUCKETS; ++i) {
+        seen += hist->buckets[i];
+        if(seen > rank) {
+            break;
+        }
+    }
+    value = nc_hist_bucket_value(i);
+    if(value < hist->min) {
+        return hist->min;
+    }
+    return value > hist->max ? hist->max : value;
+}
+
+void nc_hist_print(const struct nc_histogram *hist, FILE *stream,
+                   const char *name, double scale, const char *unit)
+{
+    if(!hist->count) {
+        fprintf(stream, "%s: no data\n", name);
+        return;
+    }
+    fprintf(stream, "%s: count %llu, min %.3f%s, avg %.3f%s, "
+        "p50 %.3f%s, p90 %.3f%s, p99 %.3f%s, p99.9 %.3f%s, max %.3f%s\n",
+        name, (unsigned long long)hist->count,
+        hist->min / scale, unit,
+        hist->sum / hist->count / scale, unit,
+        nc_hist_percentile(hist, 50) / scale, unit,
+        nc_hist_percentile(hist, 90) / scale, unit,
+        nc_hist_percentile(hist, 99) / scale, unit,
+        nc_hist_percentile(hist, 99.9) / scale, unit,
+        hist->max / scale, unit);
+}
@@ -0,0 +1,55 @@
+/*
+    Copyright (c) 2013 Insollo Entertainment, LLC.  All rights reserved.
+
+    Permission is hereby granted, free of charge, to any person obtaining a copy
+    of this software and associated documentation files (the "Software"),
+    to deal in the Software without restriction, including without limitation
+    the rights to use, copy, modify, merge, publish, distribute, sublicense,
+    and/or sell copies of the Software, and to permit persons to whom
+    the Software is furnished to do so, subject to the following conditions:
+
+    The above copyright notice and this permission notice shall be included
+    in all copies or substantial portions of the Software.
+
+    THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+    IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+    FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL
+    THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+    LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+    FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS
+    IN THE SOFTWARE.
+*/
+
+
+#ifndef NC_HISTOGRAM_HEADER
+#define NC_HISTOGRAM_HEADER
+
+#include <stdio.h>
+#include <stdint.h>
+
+/*  Log-linear histogram: every power of two is split into 8 buckets, so
+    percentiles are exact below 16 and within 12.5% above, and adding
+    a value is a few instructions with constant memory  */
+#define NC_HIST_SUBBUCKETS 8
+#define NC_HIST_BUCKETS (62 * NC_HIST_SUBBUCKETS)
+
+struct nc_histogram {
+    uint64_t count;
+    uint64_t min;
+    uint64_t max;
+    double sum;
+    uint64_t buckets[NC_HIST_BUCKETS];
+};
+
+void nc_hist_reset(struct nc_histogram *hist);
+void nc_hist_add(struct nc_histogram *hist, uint64_t value);
+
+/*  Approximate value below which ``percent`` of values are  */
+uint64_t nc_hist_percentile(const struct nc_histogram *hist, double percent);
+
+/*  Prints single line summary, values are divided by ``scale`` and
+    followed by ``unit``  */
+void nc_hist_print(const struct nc_histogram *hist, FILE *stream,
+                   const char *name, double scale, const char *unit);
+
+#endif  /* NC_HISTOGRAM_HEADER */
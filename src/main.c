@@ -20,6 +20,10 @@
     IN THE SOFTWARE.
 */
 
+#ifdef __linux__
+#define _GNU_SOURCE  /*  for CPU affinity  */
+#endif
+
 #include <nanomsg/nn.h>
 #include <nanomsg/pubsub.h>
 #include <nanomsg/pipeline.h>
@@ -27,6 +31,7 @@
 #include <nanomsg/pair.h>
 #include <nanomsg/survey.h>
 #include <nanomsg/reqrep.h>
+#include <nanomsg/tcp.h>
 
 #include <stdio.h>
 #include <string.h>
@@ -35,20 +40,40 @@
 #include <unistd.h>
 #include <time.h>
 #include <ctype.h>
+#include <stdint.h>
+#include <pthread.h>
+#include <sched.h>
+#include <signal.h>
+#include <sys/types.h>
+#include <sys/wait.h>
+#include <poll.h>
+#include <limits.h>
 
 #include "options.h"
+#include "ring.h"
+#include "output.h"
+#include "clock.h"
+#include "histogram.h"
+#include "spec.h"
+#include "format.h"
+#include "hash.h"
+#include "dedup.h"
+#include "topk.h"
+#include "shmring.h"
+#include "crc32c.h"
 
-enum echo_format {
-    NC_NO_ECHO,
-    NC_ECHO_RAW,
-    NC_ECHO_ASCII,
-    NC_ECHO_QUOTED,
-    NC_ECHO_MSGPACK
+enum shm_full {
+    NC_SHM_BLOCK,
+    NC_SHM_DROP
 };
 
 typedef struct nc_options {
     /* Global options */
     int verbose;
+    char *spec_path;
+    long count;
+    float duration;
+    int checksum;
 
     /* Socket options */
     int socket_type;
@@ -57,13 +82,51 @@ typedef struct nc_options {
     float send_timeout;
     float recv_timeout;
     struct nc_string_list subscriptions;
+    long fanout;
+    char *shard_key;
+    char *shard_delim;
+    long shard_batch;
+    int survey_stats;
+    float survey_deadline;
+    long max_msg_size;
+    long sndbuf;
+    long rcvbuf;
+    float linger;
+    long sndprio;
+    long rcvprio;
+    float reconnect_ivl;
+    int tcp_nodelay;
+    long sweep_size;
+    int selftest_bench;
+    long connections;
+    float churn_rate;
+    int busy_poll;
+    long cpu;
+    long fifo_priority;
 
     /* Output options */
     float send_interval;
+    long wait_peers;
+    float wait_timeout;
     struct nc_blob data_to_send;
+    char *handler;
 
     /* Input options */
     enum echo_format echo_format;
+    enum decode_format decode_format;
+    long format_threads;
+    long dedup;
+    float dedup_time;
+    char *dedup_key;
+    long topk;
+    char *topic_delim;
+    float topk_interval;
+    char *output_path;
+    long rotate_size;
+    float rotate_interval;
+    char *shm_ring;
+    long shm_size;
+    enum shm_full shm_full;
 } nc_options_t;
 
 /*  Constants to get address of in option declaration  */
@@ -99,6 +162,10 @@ static const int nc_echo_raw = NC_ECHO_RAW;
 static const int nc_echo_ascii = NC_ECHO_ASCII;
 static const int nc_echo_quoted = NC_ECHO_QUOTED;
 static const int nc_echo_msgpack = NC_ECHO_MSGPACK;
+static const int nc_echo_hex = NC_ECHO_HEX;
+static const int nc_echo_hexdump = NC_ECHO_HEXDUMP;
+static const int nc_echo_base64 = NC_ECHO_BASE64;
+static const int nc_echo_jsonl = NC_ECHO_JSONL;
 
 struct nc_enum_item echo_formats[] = {
     {"no", NC_NO_ECHO},
@@ -106,6 +173,22 @@ struct nc_enum_item echo_formats[] = {
     {"ascii", NC_ECHO_ASCII},
     {"quoted", NC_ECHO_QUOTED},
     {"msgpack", NC_ECHO_MSGPACK},
+    {"hex", NC_ECHO_HEX},
+    {"hexdump", NC_ECHO_HEXDUMP},
+    {"base64", NC_ECHO_BASE64},
+    {"jsonl", NC_ECHO_JSONL},
+    {NULL, 0},
+};
+
+struct nc_enum_item decode_formats[] = {
+    {"no", NC_NO_DECODE},
+    {"msgpack", NC_DECODE_MSGPACK},
+    {NULL, 0},
+};
+
+struct nc_enum_item shm_fulls[] = {
+    {"block", NC_SHM_BLOCK},
+    {"drop", NC_SHM_DROP},
     {NULL, 0},
 };
 
@@ -116,6 +199,15 @@ struct nc_enum_item echo_formats[] = {
 #define NC_MASK_SOCK_SUB 8
 #define NC_MASK_DATA 16
 #define NC_MASK_ENDPOINT 32
+#define NC_MASK_OUTPUT 64
+#define NC_MASK_SOCK_SURVEYOR 128
+#define NC_MASK_SOCK_REPLY 256
+#define NC_MASK_CONNECTIONS 512
+#define NC_MASK_SOCK_PUSH 1024
+#define NC_MASK_SHARD 2048
+#define NC_MASK_DEDUP 4096
+#define NC_MASK_TOPK 8192
+#define NC_MASK_SHM 16384
 #define NC_NO_PROVIDES 0
 #define NC_NO_CONFLICTS 0
 #define NC_NO_REQUIRES 0
@@ -133,6 +225,36 @@ struct nc_option nc_options[] = {
      NC_OPT_DECREMENT, offsetof(nc_options_t, verbose), NULL,
      NC_NO_PROVIDES, NC_NO_CONFLICTS, NC_NO_REQUIRES,
      "Generic", NULL, "Decrease verbosity of the nanocat"},
+    {"spec", 0, NULL,
+     NC_OPT_STRING, offsetof(nc_options_t, spec_path), NULL,
+     NC_MASK_SOCK|NC_MASK_ENDPOINT, NC_MASK_SOCK|NC_MASK_ENDPOINT,
+     NC_NO_REQUIRES,
+     "Generic", "FILE", "Run a socket for every line of FILE in a single "
+        "process. Every line has the same options as the command-line "
+        "(socket type, endpoints and so on). Output of all sockets goes "
+        "to the output of the process, which may only be set on the "
+        "command-line"},
+    {"count", 'n', NULL,
+     NC_OPT_INT, offsetof(nc_options_t, count), NULL,
+     NC_NO_PROVIDES, NC_NO_CONFLICTS, NC_NO_REQUIRES,
+     "Generic", "N", "Stop after N messages: sent ones for PUSH and PUB, "
+        "received ones for other sockets, requests or surveys for REQ "
+        "and SURVEYOR. Without --interval REQ waits for the reply to "
+        "every request, and SURVEYOR for the end of every survey, before "
+        "sending the next one. Prints the number "
+        "of messages and bytes and timestamps of the first and the last "
+        "message at exit"},
+    {"duration", 0, NULL,
+     NC_OPT_FLOAT, offsetof(nc_options_t, duration), NULL,
+     NC_NO_PROVIDES, NC_NO_CONFLICTS, NC_NO_REQUIRES,
+     "Generic", "SEC", "Stop after SEC seconds, same as --count otherwise"},
+    {"checksum", 0, NULL,
+     NC_OPT_INCREMENT, offsetof(nc_options_t, checksum), NULL,
+     NC_NO_PROVIDES, NC_NO_CONFLICTS, NC_NO_REQUIRES,
+     "Generic", NULL, "Append CRC32C of the message to every message sent "
+        "(4 bytes, big-endian). Received messages are checked and "
+        "stripped of it, and messages that fail the check are counted "
+        "with the stats instead of printed"},
     {"help", 'h', NULL,
      NC_OPT_HELP, 0, NULL,
      NC_NO_PROVIDES, NC_NO_CONFLICTS, NC_NO_REQUIRES,
@@ -141,7 +263,7 @@ struct nc_option nc_options[] = {
     /* Socket types */
     {"push", 'p', "nn_push",
      NC_OPT_SET_ENUM, offsetof(nc_options_t, socket_type), &nn_push,
-     NC_MASK_SOCK_WRITEABLE, NC_MASK_SOCK, NC_MASK_DATA,
+     NC_MASK_SOCK_WRITEABLE|NC_MASK_SOCK_PUSH, NC_MASK_SOCK, NC_MASK_DATA,
      "Socket Types", NULL, "Use NN_PUSH socket type"},
     {"pull", 'P', "nn_pull",
      NC_OPT_SET_ENUM, offsetof(nc_options_t, socket_type), &nn_pull,
@@ -161,15 +283,15 @@ struct nc_option nc_options[] = {
      "Socket Types", NULL, "Use NN_REQ socket type"},
     {"rep", 'r', "nn_rep",
      NC_OPT_SET_ENUM, offsetof(nc_options_t, socket_type), &nn_rep,
-     NC_MASK_SOCK_READWRITE, NC_MASK_SOCK, NC_NO_REQUIRES,
+     NC_MASK_SOCK_READWRITE|NC_MASK_SOCK_REPLY, NC_MASK_SOCK, NC_NO_REQUIRES,
      "Socket Types", NULL, "Use NN_REP socket type"},
     {"surveyor", 'U', "nn_surveyor",
      NC_OPT_SET_ENUM, offsetof(nc_options_t, socket_type), &nn_surveyor,
-     NC_MASK_SOCK_READWRITE, NC_MASK_SOCK, NC_MASK_DATA,
+     NC_MASK_SOCK_READWRITE|NC_MASK_SOCK_SURVEYOR, NC_MASK_SOCK, NC_MASK_DATA,
      "Socket Types", NULL, "Use NN_SURVEYOR socket type"},
     {"respondent", 'u', "nn_respondent",
      NC_OPT_SET_ENUM, offsetof(nc_options_t, socket_type), &nn_respondent,
-     NC_MASK_SOCK_READWRITE, NC_MASK_SOCK, NC_NO_REQUIRES,
+     NC_MASK_SOCK_READWRITE|NC_MASK_SOCK_REPLY, NC_MASK_SOCK, NC_NO_REQUIRES,
      "Socket Types", NULL, "Use NN_RESPONDENT socket type"},
     {"bus", 'B', "nn_bus",
      NC_OPT_SET_ENUM, offsetof(nc_options_t, socket_type), &nn_bus,
@@ -217,6 +339,99 @@ struct nc_option nc_options[] = {
      NC_OPT_FLOAT, offsetof(nc_options_t, send_timeout), NULL,
      NC_NO_PROVIDES, NC_NO_CONFLICTS, NC_MASK_WRITEABLE,
      "Socket Options", "SEC", "Set timeout for sending a message"},
+    {"max-msg-size", 0, NULL,
+     NC_OPT_INT, offsetof(nc_options_t, max_msg_size), NULL,
+     NC_NO_PROVIDES, NC_NO_CONFLICTS, NC_MASK_READABLE,
+     "Socket Options", "BYTES", "Drop incoming messages larger than BYTES "
+                              "(NN_RCVMAXSIZE) and receive into reusable "
+                              "buffers instead of allocating each message"},
+    {"sndbuf", 0, NULL,
+     NC_OPT_INT, offsetof(nc_options_t, sndbuf), NULL,
+     NC_NO_PROVIDES, NC_NO_CONFLICTS, NC_NO_REQUIRES,
+     "Socket Options", "BYTES", "Set size of the send buffer (NN_SNDBUF)"},
+    {"rcvbuf", 0, NULL,
+     NC_OPT_INT, offsetof(nc_options_t, rcvbuf), NULL,
+     NC_NO_PROVIDES, NC_NO_CONFLICTS, NC_NO_REQUIRES,
+     "Socket Options", "BYTES", "Set size of the receive buffer "
+                              "(NN_RCVBUF)"},
+    {"linger", 0, NULL,
+     NC_OPT_FLOAT, offsetof(nc_options_t, linger), NULL,
+     NC_NO_PROVIDES, NC_NO_CONFLICTS, NC_NO_REQUIRES,
+     "Socket Options", "SEC", "Try to deliver pending outbound messages "
+                            "for SEC seconds on close (NN_LINGER)"},
+    {"sndprio", 0, NULL,
+     NC_OPT_INT, offsetof(nc_options_t, sndprio), NULL,
+     NC_NO_PROVIDES, NC_NO_CONFLICTS, NC_NO_REQUIRES,
+     "Socket Options", "PRIO", "Set priority (1-16, 1 is highest) of "
+                             "endpoints added afterwards when sending "
+                             "(NN_SNDPRIO)"},
+    {"rcvprio", 0, NULL,
+     NC_OPT_INT, offsetof(nc_options_t, rcvprio), NULL,
+     NC_NO_PROVIDES, NC_NO_CONFLICTS, NC_NO_REQUIRES,
+     "Socket Options", "PRIO", "Set priority (1-16, 1 is highest) of "
+                             "endpoints added afterwards when receiving "
+                             "(NN_RCVPRIO)"},
+    {"reconnect-ivl", 0, NULL,
+     NC_OPT_FLOAT, offsetof(nc_options_t, reconnect_ivl), NULL,
+     NC_NO_PROVIDES, NC_NO_CONFLICTS, NC_NO_REQUIRES,
+     "Socket Options", "SEC", "Wait SEC seconds before reconnecting "
+                            "(NN_RECONNECT_IVL)"},
+    {"tcp-nodelay", 0, NULL,
+     NC_OPT_INCREMENT, offsetof(nc_options_t, tcp_nodelay), NULL,
+     NC_NO_PROVIDES, NC_NO_CONFLICTS, NC_NO_REQUIRES,
+     "Socket Options", NULL, "Disable Nagle's algorithm on TCP "
+                           "connections (NN_TCP_NODELAY)"},
+
+    /* Tuning Options */
+    {"busy-poll", 0, NULL,
+     NC_OPT_INCREMENT, offsetof(nc_options_t, busy_poll), NULL,
+     NC_NO_PROVIDES, NC_NO_CONFLICTS, NC_MASK_READABLE,
+     "Tuning Options", NULL, "Spin on non-blocking receive instead of "
+                            "sleeping, to measure latency without scheduler "
+                            "wakeups. Takes a whole CPU"},
+    {"cpu", 0, NULL,
+     NC_OPT_INT, offsetof(nc_options_t, cpu), NULL,
+     NC_NO_PROVIDES, NC_NO_CONFLICTS, NC_NO_REQUIRES,
+     "Tuning Options", "N", "Pin thread running the send/receive loop "
+                           "to CPU number N"},
+    {"fifo-priority", 0, NULL,
+     NC_OPT_INT, offsetof(nc_options_t, fifo_priority), NULL,
+     NC_NO_PROVIDES, NC_NO_CONFLICTS, NC_NO_REQUIRES,
+     "Tuning Options", "PRIO", "Run send/receive loop with SCHED_FIFO "
+                              "realtime priority PRIO (needs privileges)"},
+    {"sweep-buffers", 0, NULL,
+     NC_OPT_INT, offsetof(nc_options_t, sweep_size), NULL,
+     NC_MASK_SOCK, NC_MASK_SOCK, NC_NO_REQUIRES,
+     "Tuning Options", "SIZE", "Instead of running a socket, measure "
+        "PUSH to PULL throughput of SIZE-byte messages over the first "
+        "--bind or --connect address (e.g. tcp://127.0.0.1:5555) for "
+        "every combination of --sndbuf and --rcvbuf from 16 KiB to "
+        "16 MiB, and print the best one. Other socket options apply to "
+        "every run"},
+    {"selftest-bench", 0, NULL,
+     NC_OPT_INCREMENT, offsetof(nc_options_t, selftest_bench), NULL,
+     NC_MASK_SOCK | NC_MASK_ENDPOINT, NC_MASK_SOCK | NC_MASK_ENDPOINT,
+     NC_NO_REQUIRES,
+     "Tuning Options", NULL, "Instead of running a socket, measure "
+        "throughput and latency of every socket pairing over inproc://, "
+        "ipc:// and tcp://127.0.0.1 with several message sizes, all in "
+        "this process, and print the results as JSON. TCP runs use ports "
+        "from 25560 up. Other socket options apply to every run"},
+    {"connections", 0, NULL,
+     NC_OPT_INT, offsetof(nc_options_t, connections), NULL,
+     NC_MASK_CONNECTIONS, NC_NO_CONFLICTS, NC_MASK_SOCK,
+     "Tuning Options", "N", "Instead of a single socket, open N sockets "
+        "that connect to every --connect address, and report time from "
+        "connecting to the first message received (for PUSH the first "
+        "message accepted by a peer, for REQ and SURVEYOR the reply to "
+        "the first one sent) and how many sockets were closed before it. "
+        "PUB is not supported, it sends whether there are peers or not. "
+        "--count limits the number of reconnects"},
+    {"churn", 0, NULL,
+     NC_OPT_FLOAT, offsetof(nc_options_t, churn_rate), NULL,
+     NC_NO_PROVIDES, NC_NO_CONFLICTS, NC_MASK_CONNECTIONS,
+     "Tuning Options", "RATE", "Close the oldest of --connections and "
+        "connect it again RATE times a second"},
 
     /* Pattern-specific options */
     {"subscribe", 0, NULL,
@@ -225,6 +440,49 @@ struct nc_option nc_options[] = {
      "SUB Socket Options", "PREFIX", "Subscribe to the prefix PREFIX. "
         "Note: socket will be subscribed to everything (empty prefix) if "
         "no prefixes are specified on the command-line."},
+    {"fanout", 0, NULL,
+     NC_OPT_INT, offsetof(nc_options_t, fanout), NULL,
+     NC_NO_PROVIDES, NC_NO_CONFLICTS, NC_MASK_SOCK_SUB,
+     "SUB Socket Options", "N", "Run N subscribers, all with the same "
+        "--subscribe prefixes and --connect addresses, read by a single "
+        "poll loop. At the end print for every subscriber the number of "
+        "messages dropped and its lag behind the subscriber that was "
+        "first to receive each message. Only messages of the first "
+        "subscriber are printed"},
+    {"survey-stats", 0, NULL,
+     NC_OPT_INCREMENT, offsetof(nc_options_t, survey_stats), NULL,
+     NC_NO_PROVIDES, NC_NO_CONFLICTS, NC_MASK_SOCK_SURVEYOR,
+     "SURVEYOR Socket Options", NULL, "Print number of responses and "
+        "latency of the first and the last one for every survey, and "
+        "histograms across surveys at the end. Responses are collected "
+        "until the next survey (or for twice the deadline if there is no "
+        "--interval)"},
+    {"survey-deadline", 0, NULL,
+     NC_OPT_FLOAT, offsetof(nc_options_t, survey_deadline), NULL,
+     NC_NO_PROVIDES, NC_NO_CONFLICTS, NC_MASK_SOCK_SURVEYOR,
+     "SURVEYOR Socket Options", "SEC", "Count responses arriving later "
+        "than SEC after the survey as stragglers (default 1)"},
+    {"shard-key", 0, NULL,
+     NC_OPT_STRING, offsetof(nc_options_t, shard_key), NULL,
+     NC_MASK_DATA|NC_MASK_SHARD, NC_MASK_DATA|NC_MASK_CONNECTIONS,
+     NC_MASK_SOCK_PUSH,
+     "PUSH Socket Options", "OFFSET:LEN", "Instead of sending --data, "
+        "read newline-separated records from stdin and send each one to "
+        "a single --connect address, chosen by consistent hash of LEN "
+        "bytes of the record at OFFSET. Records with the same key always "
+        "go to the same address. A slow address doesn't hold up the "
+        "others, with --send-timeout its queued records are dropped"},
+    {"shard-delim", 0, NULL,
+     NC_OPT_STRING, offsetof(nc_options_t, shard_delim), NULL,
+     NC_NO_PROVIDES, NC_NO_CONFLICTS, NC_MASK_SHARD,
+     "PUSH Socket Options", "C", "Count OFFSET and LEN of --shard-key in "
+        "fields separated by the character C instead of bytes"},
+    {"shard-batch", 0, NULL,
+     NC_OPT_INT, offsetof(nc_options_t, shard_batch), NULL,
+     NC_NO_PROVIDES, NC_NO_CONFLICTS, NC_MASK_SHARD,
+     "PUSH Socket Options", "N", "Send up to N records of the same "
+        "address in one message, separated by newlines. Batches are sent "
+        "early when there is no more input to read (default 1)"},
 
     /* Input Options */
     {"format", 'f', NULL,
@@ -252,12 +510,128 @@ struct nc_option nc_options[] = {
      NC_NO_PROVIDES, NC_NO_CONFLICTS, NC_MASK_READABLE,
      "Input Options", NULL, "Print each message as msgpacked string (raw type)."
                            " This is useful for programmatic parsing."},
+    {"hex", 0, NULL,
+     NC_OPT_SET_ENUM, offsetof(nc_options_t, echo_format), &nc_echo_hex,
+     NC_NO_PROVIDES, NC_NO_CONFLICTS, NC_MASK_READABLE,
+     "Input Options", NULL, "Print each message on separate line as "
+                           "lowercase hexadecimal digits"},
+    {"hexdump", 0, NULL,
+     NC_OPT_SET_ENUM, offsetof(nc_options_t, echo_format), &nc_echo_hexdump,
+     NC_NO_PROVIDES, NC_NO_CONFLICTS, NC_MASK_READABLE,
+     "Input Options", NULL, "Print each message as canonical hex+ASCII "
+                           "dump (same as ``hexdump -C'')"},
+    {"base64", 0, NULL,
+     NC_OPT_SET_ENUM, offsetof(nc_options_t, echo_format), &nc_echo_base64,
+     NC_NO_PROVIDES, NC_NO_CONFLICTS, NC_MASK_READABLE,
+     "Input Options", NULL, "Print each message on separate line "
+                           "encoded in base64"},
+    {"jsonl", 0, NULL,
+     NC_OPT_SET_ENUM, offsetof(nc_options_t, echo_format), &nc_echo_jsonl,
+     NC_NO_PROVIDES, NC_NO_CONFLICTS, NC_MASK_READABLE,
+     "Input Options", NULL, "Print each message as JSON object on separate "
+                           "line, with receive time, size and sequence "
+                           "number. Payload is put in \"data\" if it's "
+                           "valid UTF-8 and in \"data_base64\" otherwise"},
+    {"decode", 0, NULL,
+     NC_OPT_ENUM, offsetof(nc_options_t, decode_format), &decode_formats,
+     NC_NO_PROVIDES, NC_NO_CONFLICTS, NC_MASK_READABLE,
+     "Input Options", "FORMAT", "Decode each message from FORMAT (only "
+                               "\"msgpack\" is supported) and print it as "
+                               "JSON on separate line. With --jsonl decoded "
+                               "value is put into \"data\" field instead"},
+    {"format-threads", 0, NULL,
+     NC_OPT_INT, offsetof(nc_options_t, format_threads), NULL,
+     NC_NO_PROVIDES, NC_NO_CONFLICTS, NC_MASK_READABLE,
+     "Input Options", "NUM", "Format received messages in NUM threads "
+                            "while another thread receives. Output is "
+                            "still printed in order of arrival"},
+    {"dedup", 0, NULL,
+     NC_OPT_INT, offsetof(nc_options_t, dedup), NULL,
+     NC_MASK_DEDUP, NC_NO_CONFLICTS, NC_MASK_READABLE,
+     "Input Options", "WINDOW", "Drop messages equal to one of the last "
+        "WINDOW messages received, before they are printed or counted. "
+        "Messages are compared by 64-bit hash, the window takes 32 bytes "
+        "per message. Number of duplicates is printed with the stats. "
+        "Not supported with --fanout"},
+    {"dedup-time", 0, NULL,
+     NC_OPT_FLOAT, offsetof(nc_options_t, dedup_time), NULL,
+     NC_NO_PROVIDES, NC_NO_CONFLICTS, NC_MASK_DEDUP,
+     "Input Options", "SEC", "Also forget --dedup messages older "
+        "than SEC"},
+    {"dedup-key", 0, NULL,
+     NC_OPT_STRING, offsetof(nc_options_t, dedup_key), NULL,
+     NC_NO_PROVIDES, NC_NO_CONFLICTS, NC_MASK_DEDUP,
+     "Input Options", "OFFSET:LEN", "Compare only LEN bytes at OFFSET "
+        "of every message for --dedup, e.g. a message id in the header"},
+    {"topk", 0, NULL,
+     NC_OPT_INT, offsetof(nc_options_t, topk), NULL,
+     NC_MASK_TOPK, NC_NO_CONFLICTS, NC_MASK_READABLE,
+     "Input Options", "K", "Print to stderr the K topics with most "
+        "messages and the K with most bytes every --topk-interval. Topic "
+        "is the start of the message up to the first space. Counts are "
+        "estimated in constant memory, so they may be a bit too high, "
+        "but never too low. K is at most 65536"},
+    {"topic-delim", 0, NULL,
+     NC_OPT_STRING, offsetof(nc_options_t, topic_delim), NULL,
+     NC_NO_PROVIDES, NC_NO_CONFLICTS, NC_MASK_TOPK,
+     "Input Options", "C", "Also count every prefix of the topic that "
+        "ends before the character C for --topk, e.g. with C being a dot "
+        "topic a.b.c is counted as a, a.b and a.b.c"},
+    {"topk-interval", 0, NULL,
+     NC_OPT_FLOAT, offsetof(nc_options_t, topk_interval), NULL,
+     NC_NO_PROVIDES, NC_NO_CONFLICTS, NC_MASK_TOPK,
+     "Input Options", "SEC", "Print and reset --topk counts every SEC "
+        "(default 1), and when receiving is over"},
+    {"output", 'o', NULL,
+     NC_OPT_STRING, offsetof(nc_options_t, output_path), NULL,
+     NC_MASK_OUTPUT, NC_NO_CONFLICTS, NC_MASK_READABLE,
+     "Input Options", "PATH", "Append output to file PATH instead of stdout. "
+                             "File is written by a separate thread, so slow "
+                             "disk doesn't delay receiving"},
+    {"rotate-size", 0, NULL,
+     NC_OPT_INT, offsetof(nc_options_t, rotate_size), NULL,
+     NC_NO_PROVIDES, NC_NO_CONFLICTS, NC_MASK_OUTPUT,
+     "Input Options", "BYTES", "Rotate output file when it grows over BYTES. "
+                              "Old file is renamed to PATH.N"},
+    {"rotate-interval", 0, NULL,
+     NC_OPT_FLOAT, offsetof(nc_options_t, rotate_interval), NULL,
+     NC_NO_PROVIDES, NC_NO_CONFLICTS, NC_MASK_OUTPUT,
+     "Input Options", "SEC", "Rotate output file every SEC seconds"},
+    {"shm-ring", 0, NULL,
+     NC_OPT_STRING, offsetof(nc_options_t, shm_ring), NULL,
+     NC_MASK_SHM, NC_NO_CONFLICTS, NC_NO_REQUIRES,
+     "Input Options", "NAME", "Also put every received message into a "
+        "ring in POSIX shared memory NAME (/dev/shm/NAME), which local "
+        "processes read in place using the API in nanocat/shmring.h. "
+        "With --spec the ring is shared by all sockets"},
+    {"shm-size", 0, NULL,
+     NC_OPT_INT, offsetof(nc_options_t, shm_size), NULL,
+     NC_NO_PROVIDES, NC_NO_CONFLICTS, NC_MASK_SHM,
+     "Input Options", "BYTES", "Size of the --shm-ring, rounded up to a "
+        "power of two (default 16 MiB)"},
+    {"shm-full", 0, NULL,
+     NC_OPT_ENUM, offsetof(nc_options_t, shm_full), &shm_fulls,
+     NC_NO_PROVIDES, NC_NO_CONFLICTS, NC_MASK_SHM,
+     "Input Options", "POLICY", "When --shm-ring is full either \"block\" "
+        "receiving until the reader catches up (default) or \"drop\" the "
+        "message. Number of dropped messages is kept in the ring header"},
 
     /* Output Options */
     {"interval", 'i', NULL,
      NC_OPT_FLOAT, offsetof(nc_options_t, send_interval), NULL,
      NC_NO_PROVIDES, NC_NO_CONFLICTS, NC_MASK_WRITEABLE,
      "Output Options", "SEC", "Send message (or request) every SEC seconds"},
+    {"wait-peers", 0, NULL,
+     NC_OPT_INT, offsetof(nc_options_t, wait_peers), NULL,
+     NC_NO_PROVIDES, NC_NO_CONFLICTS, NC_MASK_WRITEABLE,
+     "Output Options", "N", "Don't send anything until N connections to "
+        "peers are established, so that the first messages are not lost "
+        "to peers that are still connecting"},
+    {"wait-timeout", 0, NULL,
+     NC_OPT_FLOAT, offsetof(nc_options_t, wait_timeout), NULL,
+     NC_NO_PROVIDES, NC_NO_CONFLICTS, NC_MASK_WRITEABLE,
+     "Output Options", "SEC", "Fail if --wait-peers are not connected in "
+        "SEC seconds (default is to wait forever)"},
     {"data", 'D', NULL,
      NC_OPT_BLOB, offsetof(nc_options_t, data_to_send), &echo_formats,
      NC_MASK_DATA, NC_MASK_DATA, NC_MASK_WRITEABLE,
@@ -268,6 +642,16 @@ struct nc_option nc_options[] = {
      NC_OPT_READ_FILE, offsetof(nc_options_t, data_to_send), &echo_formats,
      NC_MASK_DATA, NC_MASK_DATA, NC_MASK_WRITEABLE,
      "Output Options", "PATH", "Same as --data but get data from file PATH"},
+    {"handler", 0, NULL,
+     NC_OPT_STRING, offsetof(nc_options_t, handler), NULL,
+     NC_MASK_DATA, NC_MASK_DATA, NC_MASK_SOCK_REPLY,
+     "Output Options", "CMD", "Reply to REP or RESPONDENT requests with "
+        "output of the shell command CMD. CMD is started once and gets "
+        "requests on stdin, each one as a 4-byte big-endian length "
+        "followed by the body. It must write exactly one reply per "
+        "request to stdout, in the same format and in the same order. "
+        "Requests are pipelined, CMD may read many of them before "
+        "replying"},
 
     /* Sentinel */
     {NULL}
@@ -308,6 +692,13 @@ void nc_sub_init(nc_options_t *options, int sock) {
     }
 }
 
+void nc_set_int_option(int sock, int level, int option, int value,
+                       char *description) {
+    int rc;
+    rc = nn_setsockopt(sock, level, option, &value, sizeof(value));
+    nc_assert_errno(rc == 0, description);
+}
+
 void nc_set_recv_timeout(int sock, double timeo) {
     int millis, rc;
     millis = (int)(timeo * 1000);
@@ -320,8 +711,11 @@ int nc_create_socket(nc_options_t *options) {
     int sock;
     int rc;
     int millis;
+    int size;
 
-    sock = nn_socket(AF_SP, options->socket_type);
+    /*  The --handler replies asynchronously, which needs a raw socket  */
+    sock = nn_socket(options->handler ? AF_SP_RAW : AF_SP,
+                     options->socket_type);
     nc_assert_errno(sock >= 0, "Can't create socket");
 
     /* Generic initialization */
@@ -334,6 +728,41 @@ int nc_create_socket(nc_options_t *options) {
     if(options->recv_timeout >= 0) {
         nc_set_recv_timeout(sock, options->recv_timeout);
     }
+    if(options->max_msg_size > 0) {
+        size = options->max_msg_size;
+        rc = nn_setsockopt(sock, NN_SOL_SOCKET, NN_RCVMAXSIZE,
+                           &size, sizeof(size));
+        nc_assert_errno(rc == 0, "Can't set max message size");
+    }
+    if(options->sndbuf >= 0) {
+        nc_set_int_option(sock, NN_SOL_SOCKET, NN_SNDBUF,
+                          options->sndbuf, "Can't set send buffer");
+    }
+    if(options->rcvbuf >= 0) {
+        nc_set_int_option(sock, NN_SOL_SOCKET, NN_RCVBUF,
+                          options->rcvbuf, "Can't set receive buffer");
+    }
+    if(options->linger >= 0) {
+        nc_set_int_option(sock, NN_SOL_SOCKET, NN_LINGER,
+                          (int)(options->linger * 1000), "Can't set linger");
+    }
+    if(options->sndprio > 0) {
+        nc_set_int_option(sock, NN_SOL_SOCKET, NN_SNDPRIO,
+                          options->sndprio, "Can't set send priority");
+    }
+    if(options->rcvprio > 0) {
+        nc_set_int_option(sock, NN_SOL_SOCKET, NN_RCVPRIO,
+                          options->rcvprio, "Can't set receive priority");
+    }
+    if(options->reconnect_ivl >= 0) {
+        nc_set_int_option(sock, NN_SOL_SOCKET, NN_RECONNECT_IVL,
+                          (int)(options->reconnect_ivl * 1000),
+                          "Can't set reconnect interval");
+    }
+    if(options->tcp_nodelay) {
+        nc_set_int_option(sock, NN_TCP, NN_TCP_NODELAY, 1,
+                          "Can't set TCP_NODELAY");
+    }
 
     /* Specific intitalization */
     switch(options->socket_type) {
@@ -345,269 +774,3034 @@ int nc_create_socket(nc_options_t *options) {
     return sock;
 }
 
-void nc_sleep(double seconds) {
-    struct timespec ts;
+/*  Set once SIGINT or SIGTERM is received. Loops stop at the next message
+    and sleeps are cut short  */
+int nc_stopping = 0;
+pthread_mutex_t nc_stop_lock = PTHREAD_MUTEX_INITIALIZER;
+pthread_cond_t nc_stop_cond;  /*  waits on monotonic clock if possible  */
+clockid_t nc_stop_clock = CLOCK_REALTIME;
+
+/*  Sleeps must not stall or spin when wall-clock time is stepped, so
+    they wait on the monotonic clock where condition variables support it.
+    Must be called before any threads start  */
+void nc_stop_init() {
+    pthread_condattr_t attr;
     int rc;
 
-    ts.tv_sec = (time_t)seconds;
-    ts.tv_nsec = (seconds - (time_t)seconds)*1000000000;
-    rc = nanosleep(&ts, NULL);
-    nc_assert_errno(rc == 0, "Failed to sleep");
+    rc = pthread_condattr_init(&attr);
+    errno = rc;
+    nc_assert_errno(rc == 0, "Can't init condition");
+#if defined(_POSIX_CLOCK_SELECTION) && _POSIX_CLOCK_SELECTION >= 0
+    if(pthread_condattr_setclock(&attr, CLOCK_MONOTONIC) == 0) {
+        nc_stop_clock = CLOCK_MONOTONIC;
+    }
+#endif
+    rc = pthread_cond_init(&nc_stop_cond, &attr);
+    errno = rc;
+    nc_assert_errno(rc == 0, "Can't init condition");
+    pthread_condattr_destroy(&attr);
 }
 
-double nc_time() {
+int nc_is_stopping() {
+    return __atomic_load_n(&nc_stopping, __ATOMIC_ACQUIRE);
+}
+
+void nc_sleep(double seconds) {
     struct timespec ts;
     int rc;
 
-    rc = clock_gettime(CLOCK_MONOTONIC, &ts);
-    nc_assert_errno(rc == 0, "Can't get current time");
-    return ((double)ts.tv_sec) + ts.tv_nsec*0.000000001;
+    rc = clock_gettime(nc_stop_clock, &ts);
+    nc_assert_errno(rc == 0, "Failed to sleep");
+    ts.tv_sec += (time_t)seconds;
+    ts.tv_nsec += (seconds - (time_t)seconds)*1000000000;
+    if(ts.tv_nsec >= 1000000000) {
+        ts.tv_sec += 1;
+        ts.tv_nsec -= 1000000000;
+    }
+    pthread_mutex_lock(&nc_stop_lock);
+    while(!nc_stopping) {
+        rc = pthread_cond_timedwait(&nc_stop_cond, &nc_stop_lock, &ts);
+        if(rc == ETIMEDOUT) {
+            break;
+        }
+    }
+    pthread_mutex_unlock(&nc_stop_lock);
 }
 
-void nc_print_message(nc_options_t *options, char *buf, int buflen) {
-    switch(options->echo_format) {
-    case NC_NO_ECHO:
-        return;
-    case NC_ECHO_RAW:
-        fwrite(buf, 1, buflen, stdout);
-        break;
-    case NC_ECHO_ASCII:
-        for(; buflen > 0; --buflen, ++buf) {
-            if(isprint(*buf)) {
-                fputc(*buf, stdout);
-            } else {
-                fputc('.', stdout);
-            }
-        }
-        fputc('\n', stdout);
-        break;
-    case NC_ECHO_QUOTED:
-        fputc('"', stdout);
-        for(; buflen > 0; --buflen, ++buf) {
-            switch(*buf) {
-            case '\n':
-                fprintf(stdout, "\\n");
-                break;
-            case '\r':
-                fprintf(stdout, "\\r");
-                break;
-            case '\\':
-            case '\"':
-                fprintf(stdout, "\\%c", *buf);
-                break;
-            default:
-                if(isprint(*buf)) {
-                    fputc(*buf, stdout);
-                } else {
-                    fprintf(stdout, "\\x%02x", *buf);
-                }
-            }
-        }
-        fprintf(stdout, "\"\n");
-        break;
-    case NC_ECHO_MSGPACK:
-        if(buflen < 256) {
-            fputc('\xc4', stdout);
-            fputc(buflen, stdout);
-            fwrite(buf, 1, buflen, stdout);
-        } else if(buflen < 65536) {
-            fputc('\xc5', stdout);
-            fputc(buflen >> 8, stdout);
-            fputc(buflen & 0xff, stdout);
-            fwrite(buf, 1, buflen, stdout);
+#ifdef __linux__
+cpu_set_t nc_original_cpus;  /*  affinity before --cpu  */
+#endif
+
+/*  Applies --cpu and --fifo-priority to the calling thread, which is the one
+    running the send/receive loop  */
+void nc_tune_thread(nc_options_t *options) {
+    struct sched_param param;
+    int rc;
+#ifdef __linux__
+    cpu_set_t cpus;
+#endif
+
+    if(options->cpu >= 0) {
+#ifdef __linux__
+        rc = pthread_getaffinity_np(pthread_self(),
+                                    sizeof(cpu_set_t), &nc_original_cpus);
+        errno = rc;
+        nc_assert_errno(rc == 0, "Can't get CPU affinity");
+        CPU_ZERO(&cpus);
+        if(options->cpu >= CPU_SETSIZE) {
+            errno = EINVAL;
         } else {
-            fputc('\xc6', stdout);
-            fputc(buflen >> 24, stdout);
-            fputc((buflen >> 16) & 0xff, stdout);
-            fputc((buflen >> 8) & 0xff, stdout);
-            fputc(buflen & 0xff, stdout);
-            fwrite(buf, 1, buflen, stdout);
+            CPU_SET(options->cpu, &cpus);
+            errno = pthread_setaffinity_np(pthread_self(),
+                                           sizeof(cpu_set_t), &cpus);
         }
-        break;
+        nc_assert_errno(errno == 0, "Can't set CPU affinity");
+#else
+        fprintf(stderr, "CPU affinity is not supported on this platform\n");
+        exit(1);
+#endif
+    }
+    if(options->fifo_priority > 0) {
+        param.sched_priority = options->fifo_priority;
+        rc = pthread_setschedparam(pthread_self(), SCHED_FIFO, &param);
+        errno = rc;
+        nc_assert_errno(rc == 0, "Can't set SCHED_FIFO priority");
     }
-    fflush(stdout);
 }
 
-void nc_connect_socket(nc_options_t *options, int sock) {
-    int i;
-    int rc;
+/*  Reverts nc_tune_thread() in helper threads that inherited it  */
+void nc_untune_thread(nc_options_t *options) {
+    struct sched_param param;
 
-    for(i = 0; i < options->bind_addresses.num; ++i) {
-        rc = nn_bind(sock, options->bind_addresses.items[i]);
-        nc_assert_errno(rc >= 0, "Can't bind");
+#ifdef __linux__
+    if(options->cpu >= 0) {
+        pthread_setaffinity_np(pthread_self(),
+                               sizeof(cpu_set_t), &nc_original_cpus);
     }
-    for(i = 0; i < options->connect_addresses.num; ++i) {
-        rc = nn_connect(sock, options->connect_addresses.items[i]);
-        nc_assert_errno(rc >= 0, "Can't connect");
+#endif
+    if(options->fifo_priority > 0) {
+        param.sched_priority = 0;
+        pthread_setschedparam(pthread_self(), SCHED_OTHER, &param);
+    }
+}
+
+double nc_time() {
+    return nc_clock_ns() * 0.000000001;
+}
+
+int nc_output_shared = 0;  /*  several --spec sockets write to the sink  */
+pthread_mutex_t nc_output_lock = PTHREAD_MUTEX_INITIALIZER;
+
+void nc_lock_output() {
+    if(nc_output_shared) {
+        pthread_mutex_lock(&nc_output_lock);
+    }
+}
+
+void nc_unlock_output() {
+    if(nc_output_shared) {
+        pthread_mutex_unlock(&nc_output_lock);
     }
 }
 
-void nc_send_loop(nc_options_t *options, int sock) {
+void nc_stamp_message(nc_options_t *options, struct nc_msginfo *info,
+                      unsigned long seq)
+{
     int rc;
-    double start_time, time_to_sleep;
 
-    for(;;) {
-        start_time = nc_time();
-        rc = nn_send(sock,
-            options->data_to_send.data, options->data_to_send.length,
-            0);
-        if(rc < 0 && (errno == EAGAIN || errno == EWOULDBLOCK)) {
-            fprintf(stderr, "Message not sent (EAGAIN)\n");
-        } else {
-            nc_assert_errno(rc >= 0, "Can't send");
-        }
-        if(options->send_interval >= 0) {
-            time_to_sleep = (start_time + options->send_interval) - nc_time();
-            if(time_to_sleep > 0) {
-                nc_sleep(time_to_sleep);
-            }
-        } else {
-            break;
+    info->seq = seq;
+    if(options->echo_format == NC_ECHO_JSONL) {
+        rc = clock_gettime(CLOCK_REALTIME, &info->received);
+        nc_assert_errno(rc == 0, "Can't get current time");
+    }
+}
+
+int nc_has_output(nc_options_t *options) {
+    return options->echo_format != NC_NO_ECHO ||
+           options->decode_format != NC_NO_DECODE;
+}
+
+/*  The --shm-ring, set up from the command-line, so it's shared by all
+    --spec sockets like the output  */
+struct nc_shmring nc_shm;
+int nc_shm_enabled = 0;
+enum shm_full nc_shm_full = NC_SHM_BLOCK;
+
+/*  Must be called with the output locked, there is a single producer  */
+void nc_shm_message(char *buf, int buflen) {
+    while(nc_shmring_put(&nc_shm, buf, buflen) < 0) {
+        if(nc_shm_full == NC_SHM_DROP || nc_is_stopping() ||
+           nc_shmring_record(buflen) > nc_shm.header->size) {
+            nc_shmring_drop(&nc_shm);
+            return;
         }
+        nc_sleep(0.0001);
     }
 }
 
-void nc_recv_loop(nc_options_t *options, int sock) {
+/*  With --max-msg-size messages are received into preallocated buffers
+    instead of NN_MSG chunks, which takes malloc/free out of the per-message
+    path. Larger messages are dropped by nanomsg (NN_RCVMAXSIZE)  */
+void *nc_alloc_recv_buffer(nc_options_t *options) {
+    void *buffer;
     int rc;
-    void *buf;
 
-    for(;;) {
-        rc = nn_recv(sock, &buf, NN_MSG, 0);
-        if(rc < 0 && (errno == EAGAIN || errno == EWOULDBLOCK)) {
-            continue;
-        } else if(errno == ETIMEDOUT || errno == EFSM) {
-            return;  /*  No more messages possible  */
-        } else {
-            nc_assert_errno(rc >= 0, "Can't recv");
-        }
-        nc_print_message(options, buf, rc);
-        nn_freemsg(buf);
+    if(options->max_msg_size <= 0) {
+        return NULL;
     }
+    rc = posix_memalign(&buffer, NC_CACHELINE, options->max_msg_size);
+    errno = rc;
+    nc_assert_errno(rc == 0, "Can't allocate receive buffer");
+    return buffer;
 }
 
-void nc_rw_loop(nc_options_t *options, int sock) {
+/*  Receives message into ``buffer``, or into new NN_MSG chunk if ``buffer``
+    is NULL. Message must be released with nc_free_msg().
+
+    With --busy-poll spins on non-blocking nn_recv, and since NN_RCVTIMEO
+    doesn't apply then, fails with ETIMEDOUT by itself after ``timeout``
+    seconds (negative means forever)  */
+int nc_recv_msg(nc_options_t *options, int sock, void **msg, void *buffer,
+                double timeout)
+{
     int rc;
-    void *buf;
-    double start_time, time_to_sleep;
+    int flags;
+    double deadline = -1;
 
+    flags = options->busy_poll ? NN_DONTWAIT : 0;
     for(;;) {
-        start_time = nc_time();
-        rc = nn_send(sock,
-            options->data_to_send.data, options->data_to_send.length,
-            0);
-        if(rc < 0 && (errno == EAGAIN || errno == EWOULDBLOCK)) {
-            fprintf(stderr, "Message not sent (EAGAIN)\n");
+        if(buffer) {
+            rc = nn_recv(sock, buffer, options->max_msg_size, flags);
         } else {
-            nc_assert_errno(rc >= 0, "Can't send");
+            rc = nn_recv(sock, msg, NN_MSG, flags);
         }
-        if(options->send_interval < 0) {  /*  Never send any more  */
-            nc_recv_loop(options, sock);
-            return;
+        if(rc >= 0 || !flags || (errno != EAGAIN && errno != EWOULDBLOCK)) {
+            break;
+        }
+        if(timeout >= 0) {
+            if(deadline < 0) {
+                deadline = nc_time() + timeout;
+            } else if(nc_time() >= deadline) {
+                errno = ETIMEDOUT;
+                return -1;
+            }
         }
+    }
+    if(rc < 0 || !buffer) {
+        return rc;
+    }
+    if(rc > options->max_msg_size) {  /*  transport ignored NN_RCVMAXSIZE  */
+        fprintf(stderr, "Message truncated to %ld bytes (was %d)\n",
+            options->max_msg_size, rc);
+        rc = options->max_msg_size;
+    }
+    *msg = buffer;
+    return rc;
+}
 
-        for(;;) {
-            time_to_sleep = (start_time + options->send_interval) - nc_time();
-            if(time_to_sleep <= 0) {
-                break;
+void nc_free_msg(void *msg, void *buffer) {
+    if(msg != buffer) {
+        nn_freemsg(msg);
+    }
+}
+
+/*  Formatting pipeline for --format-threads. Receiving thread hands message
+    number ``seq`` to formatter ``seq % N`` and the writer thread visits
+    formatters in the same round-robin order, so output keeps arrival order
+    without any reordering buffer. Each formatter owns a ring of slots where
+    every index is advanced by exactly one thread: ``head`` by receiver,
+    ``formatted`` by formatter and ``tail`` by writer, which keeps rings
+    lock-free. Slot output buffers (and receive buffers with --max-msg-size)
+    are reused, so after warm-up nothing is allocated per message.
+
+    Receive buffers of all slots are allocated up front, so with a large
+    --max-msg-size only part of every ring is used to keep them under
+    NC_PIPELINE_MEMORY  */
+#define NC_RING_SIZE 1024  /*  slots per formatter, power of two  */
+#define NC_RING_MIN 16
+#define NC_PIPELINE_MEMORY (512L << 20)
+
+struct nc_slot {
+    void *buffer;  /*  preallocated receive buffer, if any  */
+    void *msg;
+    int msglen;
+    struct nc_msginfo info;
+    struct nc_outbuf out;
+};
+
+struct nc_ring {
+    unsigned long head;
+    char pad1[NC_CACHELINE - sizeof(unsigned long)];
+    unsigned long formatted;
+    char pad2[NC_CACHELINE - sizeof(unsigned long)];
+    unsigned long tail;
+    char pad3[NC_CACHELINE - sizeof(unsigned long)];
+    struct nc_pipeline *pipeline;
+    pthread_t thread;
+    struct nc_slot slots[NC_RING_SIZE];
+};
+
+struct nc_pipeline {
+    nc_options_t *options;
+    int nrings;
+    unsigned long slots;  /*  used in every ring, power of two  */
+    struct nc_ring *rings;
+    pthread_t writer;
+    unsigned long seq;  /*  number of messages pushed so far  */
+    int finished;  /*  no more messages will be pushed  */
+};
+
+void *nc_formatter_thread(void *arg) {
+    struct nc_ring *ring = arg;
+    struct nc_pipeline *pipeline = ring->pipeline;
+    struct nc_slot *slot;
+    unsigned long pos;
+    int spins = 0;
+
+    nc_untune_thread(pipeline->options);
+    for(pos = 0;; ++pos) {
+        while(pos == nc_load(&ring->head)) {
+            if(__atomic_load_n(&pipeline->finished, __ATOMIC_ACQUIRE) &&
+               pos == nc_load(&ring->head)) {
+                return NULL;
             }
-            if(options->recv_timeout >= 0 &&
-                time_to_sleep > options->recv_timeout)
-            {
-                time_to_sleep = options->recv_timeout;
+            nc_backoff(&spins);
+        }
+        spins = 0;
+        slot = &ring->slots[pos & (pipeline->slots - 1)];
+        slot->out.len = 0;
+        nc_format_message(&slot->out, pipeline->options->echo_format,
+                          pipeline->options->decode_format, &slot->info,
+                          slot->msg, slot->msglen);
+        nc_free_msg(slot->msg, slot->buffer);
+        nc_store(&ring->formatted, pos + 1);
+    }
+}
+
+void *nc_writer_thread(void *arg) {
+    struct nc_pipeline *pipeline = arg;
+    struct nc_ring *ring;
+    struct nc_slot *slot;
+    unsigned long seq;
+    unsigned long pos;
+    int spins = 0;
+    int dirty = 0;
+
+    nc_untune_thread(pipeline->options);
+    for(seq = 0;; ++seq) {
+        ring = &pipeline->rings[seq % pipeline->nrings];
+        pos = ring->tail;
+        while(pos == nc_load(&ring->formatted)) {
+            if(__atomic_load_n(&pipeline->finished, __ATOMIC_ACQUIRE) &&
+               seq == pipeline->seq) {
+                nc_lock_output();
+                nc_sink_flush(&nc_output);
+                nc_unlock_output();
+                return NULL;
             }
-            nc_set_recv_timeout(sock, time_to_sleep);
-            rc = nn_recv(sock, &buf, NN_MSG, 0);
-            if(rc < 0) {
-                if(errno == EAGAIN || errno == EWOULDBLOCK) {
-                    continue;
-                } else if(errno == ETIMEDOUT || errno == EFSM) {
-                    time_to_sleep = (start_time + options->send_interval) \
-                        - nc_time();
-                    if(time_to_sleep > 0)
-                        nc_sleep(time_to_sleep);
-                    continue;
-                }
+            if(dirty) {  /*  flush only when we have to wait anyway  */
+                nc_lock_output();
+                nc_sink_flush(&nc_output);
+                nc_unlock_output();
+                dirty = 0;
             }
-            nc_assert_errno(rc >= 0, "Can't recv");
-            nc_print_message(options, buf, rc);
-            nn_freemsg(buf);
+            nc_backoff(&spins);
         }
+        spins = 0;
+        slot = &ring->slots[pos & (pipeline->slots - 1)];
+        nc_lock_output();
+        nc_sink_write(&nc_output, slot->out.data, slot->out.len);
+        nc_sink_message_end(&nc_output);
+        nc_unlock_output();
+        dirty = 1;
+        nc_store(&ring->tail, pos + 1);
     }
 }
 
-void nc_resp_loop(nc_options_t *options, int sock) {
+struct nc_pipeline *nc_pipeline_start(nc_options_t *options) {
+    struct nc_pipeline *pipeline;
+    int i;
+    int j;
     int rc;
-    void *buf;
 
-    for(;;) {
-        rc = nn_recv(sock, &buf, NN_MSG, 0);
-        if(rc < 0 && (errno == EAGAIN || errno == EWOULDBLOCK)) {
-                continue;
-        } else {
-            nc_assert_errno(rc >= 0, "Can't recv");
-        }
-        nc_print_message(options, buf, rc);
-        nn_freemsg(buf);
-        rc = nn_send(sock,
-            options->data_to_send.data, options->data_to_send.length,
-            0);
-        if(rc < 0 && (errno == EAGAIN || errno == EWOULDBLOCK)) {
-            fprintf(stderr, "Message not sent (EAGAIN)\n");
-        } else {
-            nc_assert_errno(rc >= 0, "Can't send");
+    pipeline = calloc(1, sizeof(struct nc_pipeline));
+    nc_assert_errno(pipeline != NULL, "Can't allocate pipeline");
+    pipeline->options = options;
+    pipeline->nrings = options->format_threads;
+    pipeline->slots = NC_RING_SIZE;
+    while(options->max_msg_size > 0 && pipeline->slots > NC_RING_MIN &&
+          (double)pipeline->slots * pipeline->nrings *
+          options->max_msg_size > NC_PIPELINE_MEMORY) {
+        pipeline->slots /= 2;
+    }
+    if((double)pipeline->slots * pipeline->nrings *
+       options->max_msg_size > NC_PIPELINE_MEMORY) {
+        fprintf(stderr, "Options --format-threads %ld and --max-msg-size "
+            "%ld need over %ld MiB of receive buffers\n",
+            options->format_threads, options->max_msg_size,
+            NC_PIPELINE_MEMORY >> 20);
+        exit(1);
+    }
+    pipeline->rings = calloc(pipeline->nrings, sizeof(struct nc_ring));
+    nc_assert_errno(pipeline->rings != NULL, "Can't allocate pipeline");
+    for(i = 0; i < pipeline->nrings; ++i) {
+        pipeline->rings[i].pipeline = pipeline;
+        for(j = 0; j < (int)pipeline->slots; ++j) {
+            pipeline->rings[i].slots[j].buffer = nc_alloc_recv_buffer(options);
         }
+        rc = pthread_create(&pipeline->rings[i].thread, NULL,
+                            nc_formatter_thread, &pipeline->rings[i]);
+        errno = rc;
+        nc_assert_errno(rc == 0, "Can't start formatter thread");
     }
+    rc = pthread_create(&pipeline->writer, NULL, nc_writer_thread, pipeline);
+    errno = rc;
+    nc_assert_errno(rc == 0, "Can't start writer thread");
+    return pipeline;
 }
 
-int main(int argc, char **argv) {
-    int sock;
-    nc_options_t options = {
-        .verbose = 0,
-        .socket_type = 0,
-        .bind_addresses = {NULL, 0},
-        .connect_addresses = {NULL, 0},
-        .send_timeout = -1.f,
-        .send_interval = -1.f,
-        .recv_timeout = -1.f,
-        .subscriptions = {NULL, 0},
-        .data_to_send = {NULL, 0},
-        .echo_format = NC_NO_ECHO
-        };
+/*  Waits until slot for the next message is free  */
+struct nc_slot *nc_pipeline_slot(struct nc_pipeline *pipeline) {
+    struct nc_ring *ring;
+    int spins = 0;
 
-    nc_parse_options(&nc_cli, &options, argc, argv);
-    sock = nc_create_socket(&options);
-    nc_connect_socket(&options, sock);
+    ring = &pipeline->rings[pipeline->seq % pipeline->nrings];
+    while(ring->head - nc_load(&ring->tail) == pipeline->slots) {
+        nc_backoff(&spins);  /*  formatters or output can't keep up  */
+    }
+    return &ring->slots[ring->head & (pipeline->slots - 1)];
+}
 
-    switch(options.socket_type) {
-    case NN_PUB:
-    case NN_PUSH:
-        nc_send_loop(&options, sock);
-        break;
-    case NN_SUB:
-    case NN_PULL:
-        nc_recv_loop(&options, sock);
-        break;
-    case NN_BUS:
-    case NN_PAIR:
-        if(options.data_to_send.data) {
-            nc_rw_loop(&options, sock);
-        } else {
-            nc_recv_loop(&options, sock);
-        }
-        break;
-    case NN_SURVEYOR:
-    case NN_REQ:
-        nc_rw_loop(&options, sock);
-        break;
-    case NN_REP:
-    case NN_RESPONDENT:
-        if(options.data_to_send.data) {
-            nc_resp_loop(&options, sock);
-        } else {
-            nc_recv_loop(&options, sock);
+/*  Receive buffer of the slot for the next message, NULL if there is none  */
+void *nc_pipeline_buffer(struct nc_pipeline *pipeline) {
+    return nc_pipeline_slot(pipeline)->buffer;
+}
+
+/*  Passes ownership of the message (received with nc_recv_msg into buffer
+    from nc_pipeline_buffer) to the pipeline  */
+void nc_pipeline_push(struct nc_pipeline *pipeline, void *msg, int msglen) {
+    struct nc_ring *ring;
+    struct nc_slot *slot;
+
+    ring = &pipeline->rings[pipeline->seq % pipeline->nrings];
+    slot = nc_pipeline_slot(pipeline);
+    slot->msg = msg;
+    slot->msglen = msglen;
+    nc_stamp_message(pipeline->options, &slot->info, pipeline->seq);
+    pipeline->seq += 1;
+    nc_store(&ring->head, ring->head + 1);
+}
+
+/*  Waits until everything pushed is written out  */
+void nc_pipeline_finish(struct nc_pipeline *pipeline) {
+    int i;
+    int j;
+
+    __atomic_store_n(&pipeline->finished, 1, __ATOMIC_RELEASE);
+    for(i = 0; i < pipeline->nrings; ++i) {
+        pthread_join(pipeline->rings[i].thread, NULL);
+    }
+    pthread_join(pipeline->writer, NULL);
+    for(i = 0; i < pipeline->nrings; ++i) {
+        for(j = 0; j < (int)pipeline->slots; ++j) {
+            free(pipeline->rings[i].slots[j].out.data);
+            free(pipeline->rings[i].slots[j].buffer);
         }
-        break;
     }
+    free(pipeline->rings);
+    free(pipeline);
+}
 
-    nn_close(sock);
+void nc_connect_socket(nc_options_t *options, int sock) {
+    int i;
+    int rc;
+
+    for(i = 0; i < options->bind_addresses.num; ++i) {
+        rc = nn_bind(sock, options->bind_addresses.items[i]);
+        nc_assert_errno(rc >= 0, "Can't bind");
+    }
+    if(options->shard_key) {
+        return;  /*  every address gets its own socket in nc_shard_init  */
+    }
+    for(i = 0; i < options->connect_addresses.num; ++i) {
+        rc = nn_connect(sock, options->connect_addresses.items[i]);
+        nc_assert_errno(rc >= 0, "Can't connect");
+    }
+}
+
+/*  Part of a message selected by OFFSET:LEN, counted in bytes or in fields
+    separated by ``delim``  */
+struct nc_key {
+    long offset;
+    long length;
+    int delim;  /*  -1 to count bytes  */
+};
+
+void nc_key_parse(struct nc_key *key, const char *option,
+                  const char *spec, const char *delim)
+{
+    char extra;
+    int rc;
+
+    rc = sscanf(spec, "%ld:%ld%c", &key->offset, &key->length, &extra);
+    if(rc != 2 || key->offset < 0 || key->length <= 0) {
+        fprintf(stderr, "Option %s must be OFFSET:LEN, got ``%s''\n",
+            option, spec);
+        exit(1);
+    }
+    key->delim = -1;
+    if(delim) {
+        if(strlen(delim) != 1) {
+            fprintf(stderr, "Delimiter of %s must be a single character\n",
+                option);
+            exit(1);
+        }
+        key->delim = (unsigned char)delim[0];
+    }
+}
+
+/*  Finds the key in the message. Key is clipped to the message, so short
+    messages get a shorter (maybe empty) key  */
+const char *nc_key_find(struct nc_key *key, const char *msg, int len,
+                        int *keylen)
+{
+    const char *end = msg + len;
+    const char *start;
+    const char *stop;
+    long n;
+
+    if(key->delim < 0) {
+        start = msg + (key->offset < len ? key->offset : len);
+        stop = end - start > key->length ? start + key->length : end;
+        *keylen = stop - start;
+        return start;
+    }
+    start = msg;
+    for(n = key->offset; n > 0 && start < end; --n) {
+        start = memchr(start, key->delim, end - start);
+        start = start ? start + 1 : end;
+    }
+    stop = start;
+    for(n = key->length; n > 0; --n) {
+        stop = memchr(stop, key->delim, end - stop);
+        if(!stop) {
+            stop = end;
+            break;
+        }
+        if(n > 1) {
+            stop += 1;  /*  key spans the delimiter  */
+        }
+    }
+    *keylen = stop - start;
+    return start;
+}
+
+/*  Appends --checksum of the first ``len`` bytes at ``msg + len``  */
+void nc_put_checksum(char *msg, int len) {
+    uint32_t crc;
+
+    crc = nc_crc32c(msg, len);
+    msg[len] = crc >> 24;
+    msg[len + 1] = (crc >> 16) & 0xff;
+    msg[len + 2] = (crc >> 8) & 0xff;
+    msg[len + 3] = crc & 0xff;
+}
+
+/*  Data sent is the same every time, so --checksum is appended once.
+    The old data is left alone, it may be a command-line argument, and
+    like all options it lives until exit  */
+void nc_checksum_data(nc_options_t *options) {
+    struct nc_blob *blob = &options->data_to_send;
+    char *data;
+
+    if(!options->checksum || !blob->data) {
+        return;
+    }
+    data = malloc(blob->length + 4);
+    nc_assert_errno(data != NULL, "Can't allocate data");
+    memcpy(data, blob->data, blob->length);
+    nc_put_checksum(data, blob->length);
+    blob->data = data;
+    blob->length += 4;
+}
+
+/*  Messages that went through the socket. Used to stop after --count or
+    --duration and to report at the end  */
+struct nc_stats {
+    uint64_t deadline;  /*  nc_clock_ns() when --duration is over, or 0  */
+    int timeout_ms;  /*  NN_RCVTIMEO currently set on the socket  */
+    unsigned long sent;
+    unsigned long long sent_bytes;
+    unsigned long received;
+    unsigned long long received_bytes;
+    uint64_t first;  /*  nc_clock_ns() of the first message, or 0  */
+    uint64_t last;
+    unsigned long printed;  /*  sequence number of the next --jsonl line  */
+    struct nc_dedup *dedup;  /*  of --dedup, or NULL  */
+    struct nc_key dedup_key;
+    unsigned long duplicates;
+    int checksum;  /*  --checksum  */
+    unsigned long corrupted;  /*  failed --checksum  */
+    struct nc_topk *topk;  /*  of --topk, or NULL  */
+    int topic_delim;  /*  -1 if none  */
+    uint64_t topk_interval;
+    uint64_t topk_next;  /*  nc_clock_ns() when to print the top topics  */
+    struct nc_stats *next;  /*  in nc_running_stats  */
+};
+
+/*  Stats of all running sockets, for SIGUSR1. Counters are only written by
+    the thread running the socket, but printed by the signal thread, so
+    they are written and read with relaxed atomics  */
+struct nc_stats *nc_running_stats = NULL;
+pthread_mutex_t nc_running_lock = PTHREAD_MUTEX_INITIALIZER;
+
+int nc_has_limits(nc_options_t *options) {
+    return options->count > 0 || options->duration >= 0;
+}
+
+void nc_stats_start(nc_options_t *options, struct nc_stats *stats) {
+    memset(stats, 0, sizeof(struct nc_stats));
+    stats->timeout_ms = -1;
+    if(options->recv_timeout >= 0) {
+        stats->timeout_ms = (int)(options->recv_timeout * 1000);
+    }
+    if(options->duration >= 0) {
+        stats->deadline = nc_clock_ns() +
+            (uint64_t)(options->duration * 1000000000.0);
+    }
+    stats->checksum = options->checksum;
+    if(options->dedup > 0) {
+        if(options->dedup_time != -1.f && options->dedup_time <= 0) {
+            fprintf(stderr, "Option --dedup-time must be positive\n");
+            exit(1);
+        }
+        stats->dedup = nc_dedup_new(options->dedup, options->dedup_time > 0 ?
+            (uint64_t)(options->dedup_time * 1000000000.0) : 0);
+        nc_assert_errno(stats->dedup != NULL, "Can't allocate --dedup");
+        if(options->dedup_key) {
+            nc_key_parse(&stats->dedup_key, "--dedup-key",
+                         options->dedup_key, NULL);
+        } else {
+            stats->dedup_key.offset = 0;  /*  whole message  */
+            stats->dedup_key.length = LONG_MAX;
+            stats->dedup_key.delim = -1;
+        }
+    }
+    if(options->topk < 0 || options->topk > NC_TOPK_MAX) {
+        fprintf(stderr, "Option --topk must be between 1 and %d\n",
+                NC_TOPK_MAX);
+        exit(1);
+    }
+    if(options->topk > 0) {
+        stats->topk = nc_topk_new(options->topk);
+        nc_assert_errno(stats->topk != NULL, "Can't allocate --topk");
+        stats->topic_delim = -1;
+        if(options->topic_delim) {
+            if(strlen(options->topic_delim) != 1) {
+                fprintf(stderr, "Option --topic-delim must be a single "
+                    "character\n");
+                exit(1);
+            }
+            stats->topic_delim = (unsigned char)options->topic_delim[0];
+        }
+        if(options->topk_interval <= 0) {
+            fprintf(stderr, "Option --topk-interval must be positive\n");
+            exit(1);
+        }
+        stats->topk_interval =
+            (uint64_t)(options->topk_interval * 1000000000.0);
+        stats->topk_next = nc_clock_ns() + stats->topk_interval;
+    }
+    pthread_mutex_lock(&nc_running_lock);
+    stats->next = nc_running_stats;
+    nc_running_stats = stats;
+    pthread_mutex_unlock(&nc_running_lock);
+}
+
+void nc_stats_stop(struct nc_stats *stats) {
+    struct nc_stats **ptr;
+
+    pthread_mutex_lock(&nc_running_lock);
+    for(ptr = &nc_running_stats; *ptr; ptr = &(*ptr)->next) {
+        if(*ptr == stats) {
+            *ptr = stats->next;
+            break;
+        }
+    }
+    pthread_mutex_unlock(&nc_running_lock);
+    if(stats->dedup) {
+        nc_dedup_free(stats->dedup);
+        stats->dedup = NULL;
+    }
+    if(stats->topk) {
+        nc_topk_print(stats->topk, stderr, "topics");
+        nc_topk_free(stats->topk);
+        stats->topk = NULL;
+    }
+}
+
+void nc_stats_stamp(struct nc_stats *stats) {
+    uint64_t now;
+
+    now = nc_clock_ns();
+    if(!stats->first) {
+        __atomic_store_n(&stats->first, now, __ATOMIC_RELAXED);
+    }
+    __atomic_store_n(&stats->last, now, __ATOMIC_RELAXED);
+}
+
+void nc_stats_sent(struct nc_stats *stats, int len) {
+    __atomic_store_n(&stats->sent, stats->sent + 1, __ATOMIC_RELAXED);
+    __atomic_store_n(&stats->sent_bytes, stats->sent_bytes + len,
+                     __ATOMIC_RELAXED);
+    nc_stats_stamp(stats);
+}
+
+void nc_stats_received(struct nc_stats *stats, int len) {
+    __atomic_store_n(&stats->received, stats->received + 1,
+                     __ATOMIC_RELAXED);
+    __atomic_store_n(&stats->received_bytes, stats->received_bytes + len,
+                     __ATOMIC_RELAXED);
+    nc_stats_stamp(stats);
+}
+
+void nc_stats_merge(struct nc_stats *stats, struct nc_stats *other) {
+    __atomic_store_n(&stats->sent, stats->sent + other->sent,
+                     __ATOMIC_RELAXED);
+    __atomic_store_n(&stats->sent_bytes,
+                     stats->sent_bytes + other->sent_bytes,
+                     __ATOMIC_RELAXED);
+    __atomic_store_n(&stats->received, stats->received + other->received,
+                     __ATOMIC_RELAXED);
+    __atomic_store_n(&stats->received_bytes,
+                     stats->received_bytes + other->received_bytes,
+                     __ATOMIC_RELAXED);
+    if(other->first && (!stats->first || other->first < stats->first)) {
+        __atomic_store_n(&stats->first, other->first, __ATOMIC_RELAXED);
+    }
+    if(other->last > stats->last) {
+        __atomic_store_n(&stats->last, other->last, __ATOMIC_RELAXED);
+    }
+    __atomic_store_n(&stats->duplicates,
+                     stats->duplicates + other->duplicates,
+                     __ATOMIC_RELAXED);
+    __atomic_store_n(&stats->corrupted,
+                     stats->corrupted + other->corrupted,
+                     __ATOMIC_RELAXED);
+}
+
+/*  Whether ``done`` messages reach --count or --duration is over  */
+int nc_stats_over(nc_options_t *options, struct nc_stats *stats,
+                  unsigned long done) {
+    if(nc_is_stopping()) {
+        return 1;
+    }
+    if(options->count > 0 && done >= (unsigned long)options->count) {
+        return 1;
+    }
+    return stats->deadline && nc_clock_ns() >= stats->deadline;
+}
+
+/*  Caps ``timeout`` (negative is infinite) by the rest of --duration  */
+double nc_stats_timeout(struct nc_stats *stats, double timeout) {
+    uint64_t now;
+    double left;
+
+    if(!stats->deadline) {
+        return timeout;
+    }
+    now = nc_clock_ns();
+    left = now < stats->deadline ?
+        (stats->deadline - now) * 0.000000001 : 0;
+    return timeout < 0 || left < timeout ? left : timeout;
+}
+
+/*  Caps ``timeout`` (negative is infinite) by the time left to the next
+    --topk report  */
+double nc_stats_topk_timeout(struct nc_stats *stats, double timeout) {
+    uint64_t now;
+    double left;
+
+    if(!stats->topk) {
+        return timeout;
+    }
+    now = nc_clock_ns();
+    left = now < stats->topk_next ?
+        (stats->topk_next - now) * 0.000000001 : 0;
+    return timeout < 0 || left < timeout ? left : timeout;
+}
+
+/*  Rest of --recv-timeout for a receive that started at ``start``  */
+double nc_stats_recv_left(nc_options_t *options, uint64_t start) {
+    double left;
+
+    if(options->recv_timeout < 0) {
+        return -1;
+    }
+    left = options->recv_timeout - (nc_clock_ns() - start) * 0.000000001;
+    return left > 0 ? left : 0;
+}
+
+/*  Sets the receive timeout of the socket. It's only changed when it
+    changes by a millisecond, so it's cheap to call for every message  */
+void nc_stats_set_timeout(struct nc_stats *stats, int sock, double timeout) {
+    int millis;
+    int rc;
+
+    /*  Round up, so that receive doesn't time out before the deadline  */
+    millis = timeout < 0 ? -1 : (int)(timeout * 1000 + 0.999);
+    if(millis != stats->timeout_ms) {
+        rc = nn_setsockopt(sock, NN_SOL_SOCKET, NN_RCVTIMEO,
+                           &millis, sizeof(millis));
+        nc_assert_errno(rc == 0, "Can't set recv timeout");
+        stats->timeout_ms = millis;
+    }
+}
+
+/*  Makes blocking receive return when --duration is over, costs nothing
+    unless there is a --duration  */
+void nc_stats_update_timeout(nc_options_t *options, struct nc_stats *stats,
+                             int sock) {
+    if(stats->deadline) {
+        nc_stats_set_timeout(stats, sock,
+            nc_stats_timeout(stats, options->recv_timeout));
+    }
+}
+
+/*  Whether the message was already received within the --dedup window  */
+int nc_stats_duplicate(struct nc_stats *stats, const char *msg, int len) {
+    const char *key;
+    int keylen;
+
+    key = nc_key_find(&stats->dedup_key, msg, len, &keylen);
+    if(!nc_dedup_seen(stats->dedup, nc_hash(key, keylen), nc_clock_ns())) {
+        return 0;
+    }
+    __atomic_store_n(&stats->duplicates, stats->duplicates + 1,
+                     __ATOMIC_RELAXED);
+    return 1;
+}
+
+/*  Returns length of the message without the --checksum, or -1 (and
+    counts the message) if the checksum doesn't match  */
+int nc_stats_checksum(struct nc_stats *stats, const char *msg, int len) {
+    if(len >= 4 && nc_crc32c(msg, len - 4) ==
+       nc_get_be((const unsigned char *)msg + len - 4, 4)) {
+        return len - 4;
+    }
+    __atomic_store_n(&stats->corrupted, stats->corrupted + 1,
+                     __ATOMIC_RELAXED);
+    return -1;
+}
+
+/*  Top topics are printed and forgotten every --topk-interval, so they
+    show what is busy now. Returns whether they were printed  */
+int nc_stats_topk_report(struct nc_stats *stats) {
+    uint64_t now;
+
+    if(!stats->topk) {
+        return 0;
+    }
+    now = nc_clock_ns();
+    if(now < stats->topk_next) {
+        return 0;
+    }
+    nc_topk_print(stats->topk, stderr, "topics");
+    nc_topk_reset(stats->topk);
+    stats->topk_next = now + stats->topk_interval;
+    return 1;
+}
+
+/*  Counts the topic of the message for --topk, and every prefix of it
+    that ends before a --topic-delim. Topic is the start of the message up
+    to the first space or control character  */
+void nc_stats_topics(struct nc_stats *stats, const char *msg, int len) {
+    int topiclen;
+
+    for(topiclen = 0; topiclen < len && topiclen < NC_TOPK_MAXKEY &&
+                      (unsigned char)msg[topiclen] > ' '; ++topiclen) {
+        if((unsigned char)msg[topiclen] == stats->topic_delim) {
+            nc_topk_add(stats->topk, msg, topiclen, len);
+        }
+    }
+    nc_topk_add(stats->topk, msg, topiclen, len);
+    nc_stats_topk_report(stats);
+}
+
+/*  Counts a received message, every receive path goes through here.
+    Returns length of the message without the --checksum, or -1 if the
+    message fails the checksum or is a --dedup duplicate, and is to be
+    skipped  */
+int nc_stats_accept(struct nc_stats *stats, const char *msg, int len) {
+    if(stats->checksum) {
+        len = nc_stats_checksum(stats, msg, len);
+        if(len < 0) {
+            return -1;
+        }
+    }
+    if(stats->dedup && nc_stats_duplicate(stats, msg, len)) {
+        return -1;
+    }
+    nc_stats_received(stats, len);
+    if(stats->topk) {
+        nc_stats_topics(stats, msg, len);
+    }
+    return len;
+}
+
+/*  Receives the next message, skipping --dedup duplicates. Wakes up to
+    print --topk reports when no message comes  */
+int nc_stats_recv(nc_options_t *options, struct nc_stats *stats, int sock,
+                  void **msg, void *buffer) {
+    uint64_t start;
+    double timeout;
+    double wait;
+    int rc;
+
+    start = nc_clock_ns();
+    for(;;) {
+        timeout = nc_stats_timeout(stats, nc_stats_recv_left(options, start));
+        wait = nc_stats_topk_timeout(stats, timeout);
+        if(stats->deadline || stats->topk) {
+            nc_stats_set_timeout(stats, sock, wait);
+        }
+        rc = nc_recv_msg(options, sock, msg, buffer, wait);
+        if(rc < 0 && errno == ETIMEDOUT && (timeout < 0 || wait < timeout)) {
+            nc_stats_topk_report(stats);
+            continue;
+        }
+        if(rc < 0) {
+            return rc;
+        }
+        rc = nc_stats_accept(stats, *msg, rc);
+        if(rc >= 0) {
+            return rc;
+        }
+        nc_free_msg(*msg, buffer);
+    }
+}
+
+/*  Numbers messages of every socket separately, for --jsonl  */
+void nc_print_message(nc_options_t *options, struct nc_stats *stats,
+                      char *buf, int buflen)
+{
+    struct nc_msginfo info;
+
+    if(!nc_has_output(options)) {
+        if(nc_shm_enabled) {
+            nc_lock_output();
+            nc_shm_message(buf, buflen);
+            nc_unlock_output();
+        }
+        return;
+    }
+    nc_lock_output();
+    if(nc_shm_enabled) {
+        nc_shm_message(buf, buflen);
+    }
+    nc_stamp_message(options, &info, stats->printed);
+    nc_write_message(options->echo_format, options->decode_format,
+                     &info, buf, buflen);
+    stats->printed += 1;
+    nc_unlock_output();
+}
+
+void nc_stats_print(struct nc_stats *running) {
+    struct nc_stats copy;
+    struct nc_stats *stats = &copy;
+    struct timespec now;
+    double offset;
+    double span;
+    unsigned long messages;
+    unsigned long long bytes;
+
+    copy.sent = __atomic_load_n(&running->sent, __ATOMIC_RELAXED);
+    copy.sent_bytes = __atomic_load_n(&running->sent_bytes,
+                                      __ATOMIC_RELAXED);
+    copy.received = __atomic_load_n(&running->received, __ATOMIC_RELAXED);
+    copy.received_bytes = __atomic_load_n(&running->received_bytes,
+                                          __ATOMIC_RELAXED);
+    copy.first = __atomic_load_n(&running->first, __ATOMIC_RELAXED);
+    copy.last = __atomic_load_n(&running->last, __ATOMIC_RELAXED);
+    copy.duplicates = __atomic_load_n(&running->duplicates,
+                                      __ATOMIC_RELAXED);
+    copy.corrupted = __atomic_load_n(&running->corrupted, __ATOMIC_RELAXED);
+
+    fprintf(stderr, "Sent %lu messages (%llu bytes), "
+        "received %lu messages (%llu bytes)\n",
+        stats->sent, stats->sent_bytes,
+        stats->received, stats->received_bytes);
+    if(running->dedup || stats->duplicates) {
+        fprintf(stderr, "Dropped %lu duplicates\n", stats->duplicates);
+    }
+    if((running->checksum && stats->received) || stats->corrupted) {
+        fprintf(stderr, "Checksum failed for %lu messages\n",
+                stats->corrupted);
+    }
+    if(!stats->first) {
+        return;
+    }
+
+    /*  Timestamps are taken with nc_clock_ns(), convert them to wall time  */
+    clock_gettime(CLOCK_REALTIME, &now);
+    offset = now.tv_sec + now.tv_nsec * 0.000000001 -
+        nc_clock_ns() * 0.000000001;
+    span = (stats->last - stats->first) * 0.000000001;
+    fprintf(stderr, "First message at %.6f, last at %.6f (%.6f s)\n",
+        offset + stats->first * 0.000000001,
+        offset + stats->last * 0.000000001, span);
+    if(span > 0) {
+        messages = stats->received ? stats->received : stats->sent;
+        bytes = stats->received ? stats->received_bytes : stats->sent_bytes;
+        fprintf(stderr, "%.0f msg/s, %.3f MB/s\n",
+            messages / span, bytes / span / 1048576);
+    }
+}
+
+void nc_wait_peers(nc_options_t *options, int sock) {
+    double start;
+    double delay;
+    uint64_t peers;
+
+    start = nc_time();
+    delay = 0.001;
+    for(;;) {
+        peers = nn_get_statistic(sock, NN_STAT_CURRENT_CONNECTIONS);
+        if(peers >= (uint64_t)options->wait_peers) {
+            return;
+        }
+        if(options->wait_timeout >= 0 &&
+           nc_time() - start >= options->wait_timeout) {
+            fprintf(stderr, "Only %llu of %ld peers connected\n",
+                (unsigned long long)peers, options->wait_peers);
+            errno = ETIMEDOUT;
+            nc_assert_errno(0, "Can't wait for peers");
+        }
+        if(nc_is_stopping()) {
+            return;
+        }
+        nc_sleep(delay);
+        if(delay < 0.05) {
+            delay *= 2;
+        }
+    }
+}
+
+void nc_send_loop(nc_options_t *options, int sock,
+                  struct nc_stats *stats) {
+    int rc;
+    double start_time, time_to_sleep;
+
+    for(;;) {
+        if(nc_stats_over(options, stats, stats->sent)) {
+            break;
+        }
+        start_time = nc_time();
+        rc = nn_send(sock,
+            options->data_to_send.data, options->data_to_send.length,
+            0);
+        if(rc < 0 && (errno == EAGAIN || errno == EWOULDBLOCK)) {
+            fprintf(stderr, "Message not sent (EAGAIN)\n");
+        } else if(rc < 0 && errno == ETERM) {
+            break;  /*  Stopped by a signal  */
+        } else {
+            nc_assert_errno(rc >= 0, "Can't send");
+            nc_stats_sent(stats, rc);
+        }
+        if(options->send_interval >= 0) {
+            time_to_sleep = (start_time + options->send_interval) - nc_time();
+            if(time_to_sleep > 0) {
+                nc_sleep(nc_stats_timeout(stats, time_to_sleep));
+            }
+        } else if(!nc_has_limits(options)) {
+            break;
+        }
+    }
+}
+
+/*  Points on the --shard-key hash ring per --connect address, so that
+    keys are spread evenly and adding or removing an address only moves
+    the keys of that address  */
+#define NC_SHARD_POINTS 64
+/*  Size of reads from stdin, records may be longer  */
+#define NC_SHARD_READ 65536
+/*  Bytes queued for a worker that doesn't keep up. Over this stdin
+    isn't read until the worker takes some, so the queue never takes more
+    than twice as much memory  */
+#define NC_SHARD_QUEUE (16 << 20)
+
+struct nc_shard_point {
+    uint64_t hash;
+    int shard;
+};
+
+/*  PUSH socket connected to a single worker, with the batch of records
+    not yet sent to it. Messages are sent with NN_DONTWAIT, the ones the
+    worker doesn't accept wait in ``queue``, so a slow worker doesn't
+    stall the others  */
+struct nc_shard {
+    int sock;
+    char *address;
+    struct nc_outbuf batch;
+    int batched;
+    struct nc_outbuf queue;  /*  4-byte length and body of each message  */
+    int queued;  /*  offset of the first message in the queue  */
+    uint64_t stalled;  /*  nc_clock_ns() of the first refused send, or 0  */
+    unsigned long records;
+    unsigned long messages;
+    unsigned long dropped;
+};
+
+struct nc_sharder {
+    struct nc_key key;
+    int num;
+    struct nc_shard *shards;
+    struct nc_shard_point *ring;
+};
+
+int nc_shard_point_cmp(const void *a, const void *b) {
+    const struct nc_shard_point *pa = a;
+    const struct nc_shard_point *pb = b;
+
+    if(pa->hash != pb->hash) {
+        return pa->hash < pb->hash ? -1 : 1;
+    }
+    return pa->shard - pb->shard;
+}
+
+/*  Shard owning the first point at or after the hash of the key  */
+struct nc_shard *nc_shard_find(struct nc_sharder *sharder,
+                               const char *key, int keylen)
+{
+    uint64_t hash;
+    int npoints;
+    int lo;
+    int hi;
+    int mid;
+
+    hash = nc_hash(key, keylen);
+    npoints = sharder->num * NC_SHARD_POINTS;
+    lo = 0;
+    hi = npoints;
+    while(lo < hi) {
+        mid = lo + (hi - lo) / 2;
+        if(sharder->ring[mid].hash < hash) {
+            lo = mid + 1;
+        } else {
+            hi = mid;
+        }
+    }
+    return &sharder->shards[sharder->ring[lo % npoints].shard];
+}
+
+/*  Sends queued messages until the worker refuses one. With --send-timeout
+    a worker that refuses messages for longer loses the whole queue.
+    Returns -1 if terminated  */
+int nc_shard_send(nc_options_t *options, struct nc_stats *stats,
+                  struct nc_shard *shard)
+{
+    unsigned long dropped;
+    uint64_t now;
+    int len;
+    int rc;
+
+    while(shard->queued < shard->queue.len) {
+        memcpy(&len, shard->queue.data + shard->queued, sizeof(len));
+        rc = nn_send(shard->sock, shard->queue.data + shard->queued + 4,
+                     len, NN_DONTWAIT);
+        if(rc < 0 && errno == ETERM) {
+            return -1;  /*  Stopped by a signal  */
+        } else if(rc < 0) {
+            nc_assert_errno(errno == EAGAIN || errno == EWOULDBLOCK,
+                            "Can't send");
+            now = nc_clock_ns();
+            if(!shard->stalled) {
+                shard->stalled = now;
+            }
+            if(options->send_timeout < 0 || now - shard->stalled <
+               (uint64_t)(options->send_timeout * 1000000000.0)) {
+                /*  Messages sent are moved out once they are the larger
+                    part, so a worker that never catches up doesn't keep
+                    all of them  */
+                if(shard->queued > shard->queue.len / 2) {
+                    shard->queue.len -= shard->queued;
+                    memmove(shard->queue.data,
+                            shard->queue.data + shard->queued,
+                            shard->queue.len);
+                    shard->queued = 0;
+                }
+                return 0;
+            }
+            for(dropped = 0; shard->queued < shard->queue.len; ++dropped) {
+                memcpy(&len, shard->queue.data + shard->queued, sizeof(len));
+                shard->queued += 4 + len;
+            }
+            fprintf(stderr, "%s: Messages not accepted for %.3f s, "
+                "dropped %lu\n", shard->address, options->send_timeout,
+                dropped);
+            shard->dropped += dropped;
+            break;
+        }
+        nc_stats_sent(stats, rc);
+        shard->messages += 1;
+        shard->queued += 4 + len;
+    }
+    shard->stalled = 0;
+    shard->queue.len = 0;
+    shard->queued = 0;
+    return 0;
+}
+
+/*  Queues the batch and sends what the worker accepts, returns -1 if
+    terminated  */
+int nc_shard_flush(nc_options_t *options, struct nc_stats *stats,
+                   struct nc_shard *shard)
+{
+    int len;
+
+    if(!shard->batched) {
+        return 0;
+    }
+    if(options->checksum) {
+        nc_out_reserve(&shard->batch, 4);
+        nc_put_checksum(shard->batch.data, shard->batch.len);
+        shard->batch.len += 4;
+    }
+    len = shard->batch.len;
+    nc_out_write(&shard->queue, (char *)&len, sizeof(len));
+    nc_out_write(&shard->queue, shard->batch.data, len);
+    shard->batch.len = 0;
+    shard->batched = 0;
+    return nc_shard_send(options, stats, shard);
+}
+
+/*  Retries sending to the workers that refused messages. Returns 1 if a
+    queue is too long to read more input, -1 if terminated  */
+int nc_shard_retry(nc_options_t *options, struct nc_stats *stats,
+                   struct nc_sharder *sharder)
+{
+    struct nc_shard *shard;
+    int full = 0;
+    int rc;
+    int i;
+
+    for(i = 0; i < sharder->num; ++i) {
+        shard = &sharder->shards[i];
+        if(shard->queued < shard->queue.len) {
+            rc = nc_shard_send(options, stats, shard);
+            if(rc < 0) {
+                return -1;
+            }
+            if(shard->queue.len > NC_SHARD_QUEUE) {
+                full = 1;
+            }
+        }
+    }
+    return full;
+}
+
+/*  Whether some worker has messages waiting  */
+int nc_shard_stalled(struct nc_sharder *sharder) {
+    int i;
+
+    for(i = 0; i < sharder->num; ++i) {
+        if(sharder->shards[i].queued < sharder->shards[i].queue.len) {
+            return 1;
+        }
+    }
+    return 0;
+}
+
+/*  Adds the record to the batch of its shard, returns -1 if terminated  */
+int nc_shard_record(nc_options_t *options, struct nc_stats *stats,
+                    struct nc_sharder *sharder, const char *rec, int len)
+{
+    struct nc_shard *shard;
+    const char *key;
+    int keylen;
+
+    key = nc_key_find(&sharder->key, rec, len, &keylen);
+    shard = nc_shard_find(sharder, key, keylen);
+    if(shard->batched) {
+        nc_out_putc(&shard->batch, '\n');
+    }
+    nc_out_write(&shard->batch, rec, len);
+    shard->batched += 1;
+    shard->records += 1;
+    if(shard->batched >= options->shard_batch) {
+        return nc_shard_flush(options, stats, shard);
+    }
+    return 0;
+}
+
+void nc_shard_init(nc_options_t *options, int sock,
+                   struct nc_sharder *sharder)
+{
+    char point[512];
+    int rc;
+    int i;
+    int j;
+
+    nc_key_parse(&sharder->key, "--shard-key", options->shard_key,
+                 options->shard_delim);
+    if(options->bind_addresses.num || !options->connect_addresses.num) {
+        fprintf(stderr, "Shards of --shard-key are --connect addresses, "
+            "--bind is not supported\n");
+        exit(1);
+    }
+
+    sharder->num = options->connect_addresses.num;
+    sharder->shards = calloc(sharder->num, sizeof(struct nc_shard));
+    sharder->ring = calloc(sharder->num * NC_SHARD_POINTS,
+                           sizeof(struct nc_shard_point));
+    nc_assert_errno(sharder->shards && sharder->ring,
+                    "Can't allocate shards");
+    for(i = 0; i < sharder->num; ++i) {
+        sharder->shards[i].address = options->connect_addresses.items[i];
+        sharder->shards[i].sock = i ? nc_create_socket(options) : sock;
+        rc = nn_connect(sharder->shards[i].sock,
+                        sharder->shards[i].address);
+        nc_assert_errno(rc >= 0, "Can't connect");
+        /*  Points depend on the address only, not on its position  */
+        for(j = 0; j < NC_SHARD_POINTS; ++j) {
+            snprintf(point, sizeof(point), "%s#%d",
+                     sharder->shards[i].address, j);
+            sharder->ring[i * NC_SHARD_POINTS + j].hash =
+                nc_hash(point, strlen(point));
+            sharder->ring[i * NC_SHARD_POINTS + j].shard = i;
+        }
+    }
+    qsort(sharder->ring, sharder->num * NC_SHARD_POINTS,
+          sizeof(struct nc_shard_point), nc_shard_point_cmp);
+}
+
+/*  Reads newline-separated records from stdin and sends each one to the
+    --connect address chosen by the hash of its --shard-key, up to
+    --shard-batch records in a message. Batches are flushed whenever stdin
+    has nothing more to read, so a slow producer doesn't delay records.
+    ``sock`` is used for the first address  */
+void nc_shard_loop(nc_options_t *options, int sock,
+                   struct nc_stats *stats) {
+    struct nc_sharder sharder;
+    struct pollfd input;
+    unsigned long records;
+    double timeout;
+    char *buf;
+    char *rec;
+    char *eol;
+    int size;
+    int len;
+    int rc;
+    int i;
+
+    nc_shard_init(options, sock, &sharder);
+    size = NC_SHARD_READ;
+    buf = malloc(size);
+    nc_assert_errno(buf != NULL, "Can't allocate input buffer");
+    len = 0;
+    records = 0;
+    rc = 0;
+    input.fd = 0;
+    input.events = POLLIN;
+
+    while(rc >= 0 && !nc_stats_over(options, stats, records)) {
+        rc = nc_shard_retry(options, stats, &sharder);
+        if(rc < 0) {
+            break;
+        } else if(rc > 0) {
+            nc_sleep(0.001);  /*  a worker is far behind, wait for it  */
+            continue;
+        }
+        /*  Signals are handled by sigwait(), so block in poll() for a
+            limited time only to notice them. Refused messages are
+            retried every millisecond  */
+        timeout = nc_stats_timeout(stats,
+            nc_shard_stalled(&sharder) ? 0.001 : 0.1);
+        rc = poll(&input, 1, (int)(timeout * 1000 + 0.999));
+        if(rc < 0 && errno == EINTR) {
+            rc = 0;
+            continue;
+        }
+        nc_assert_errno(rc >= 0, "Can't poll stdin");
+        if(rc == 0) {
+            for(i = 0; i < sharder.num && rc >= 0; ++i) {
+                rc = nc_shard_flush(options, stats, &sharder.shards[i]);
+            }
+            continue;
+        }
+
+        if(len == size) {
+            size *= 2;
+            buf = realloc(buf, size);
+            nc_assert_errno(buf != NULL, "Can't allocate input buffer");
+        }
+        rc = read(0, buf + len, size - len);
+        nc_assert_errno(rc >= 0, "Can't read stdin");
+        if(rc == 0) {
+            if(len > 0) {  /*  last record without a newline  */
+                rc = nc_shard_record(options, stats, &sharder, buf, len);
+                records += 1;
+            }
+            break;
+        }
+        len += rc;
+        rc = 0;
+        rec = buf;
+        while(rc >= 0 && !nc_stats_over(options, stats, records) &&
+              (eol = memchr(rec, '\n', buf + len - rec))) {
+            rc = nc_shard_record(options, stats, &sharder, rec, eol - rec);
+            records += 1;
+            rec = eol + 1;
+        }
+        len = buf + len - rec;
+        memmove(buf, rec, len);
+    }
+
+    for(i = 0; i < sharder.num && rc >= 0; ++i) {
+        rc = nc_shard_flush(options, stats, &sharder.shards[i]);
+    }
+    while(rc >= 0 && !nc_is_stopping() && nc_shard_stalled(&sharder)) {
+        rc = nc_shard_retry(options, stats, &sharder);
+        nc_sleep(0.001);
+    }
+    for(i = 0; i < sharder.num; ++i) {
+        if(options->verbose > 0) {
+            fprintf(stderr, "%s: %lu records in %lu messages",
+                sharder.shards[i].address, sharder.shards[i].records,
+                sharder.shards[i].messages);
+            if(sharder.shards[i].dropped) {
+                fprintf(stderr, ", %lu messages dropped",
+                        sharder.shards[i].dropped);
+            }
+            fprintf(stderr, "\n");
+        }
+        if(i > 0) {
+            nn_close(sharder.shards[i].sock);
+        }
+        free(sharder.shards[i].batch.data);
+        free(sharder.shards[i].queue.data);
+    }
+    free(buf);
+    free(sharder.ring);
+    free(sharder.shards);
+}
+
+void nc_recv_loop(nc_options_t *options, int sock,
+                  struct nc_stats *stats) {
+    int rc;
+    void *buf;
+    void *buffer = NULL;
+    struct nc_pipeline *pipeline = NULL;
+
+    if(options->format_threads > 0 && nc_has_output(options)) {
+        pipeline = nc_pipeline_start(options);
+    } else {
+        buffer = nc_alloc_recv_buffer(options);
+    }
+    for(;;) {
+        if(nc_stats_over(options, stats, stats->received)) {
+            break;
+        }
+        if(pipeline) {
+            buffer = nc_pipeline_buffer(pipeline);
+        }
+        rc = nc_stats_recv(options, stats, sock, &buf, buffer);
+        if(rc < 0 && (errno == EAGAIN || errno == EWOULDBLOCK)) {
+            continue;
+        } else if(rc < 0 && (errno == ETIMEDOUT || errno == EFSM ||
+                             errno == ETERM)) {
+            break;  /*  No more messages possible  */
+        } else {
+            nc_assert_errno(rc >= 0, "Can't recv");
+        }
+        if(pipeline) {
+            if(nc_shm_enabled) {
+                nc_lock_output();
+                nc_shm_message(buf, rc);
+                nc_unlock_output();
+            }
+            nc_pipeline_push(pipeline, buf, rc);
+        } else {
+            nc_print_message(options, stats, buf, rc);
+            nc_free_msg(buf, buffer);
+        }
+    }
+    if(pipeline) {
+        nc_pipeline_finish(pipeline);
+    } else {
+        free(buffer);
+    }
+}
+
+/*  Arrival times of the last messages kept by --fanout to compute lag  */
+#define NC_FANOUT_WINDOW 65536
+/*  Messages taken from one subscriber at a time, so that draining one
+    doesn't delay the others much  */
+#define NC_FANOUT_BATCH 16
+
+/*  A subscriber of --fanout. All subscribers get the same messages, so
+    n-th message of every subscriber is matched with n-th message of the
+    one that is ahead: the difference in arrival time is the lag, and
+    the difference in number of messages at the end is the drops. After
+    a drop, lag includes the time of the dropped messages  */
+struct nc_subscriber {
+    int sock;
+    unsigned long received;
+    uint64_t lag_sum;
+    uint64_t lag_max;
+    unsigned long behind;  /*  messages lagging more than the window  */
+};
+
+void nc_fanout_print(struct nc_subscriber *subs, int num,
+                     unsigned long ahead, struct nc_histogram *lag)
+{
+    struct nc_subscriber *sub;
+    unsigned long dropped;
+    unsigned long total;
+    int droppers;
+    int i;
+
+    fprintf(stderr, "%10s %10s %10s %12s %12s %10s\n", "SUBSCRIBER",
+        "RECEIVED", "DROPPED", "AVG LAG ms", "MAX LAG ms", "BEHIND");
+    total = 0;
+    droppers = 0;
+    for(i = 0; i < num; ++i) {
+        sub = &subs[i];
+        dropped = ahead - sub->received;
+        total += dropped;
+        droppers += dropped > 0;
+        fprintf(stderr, "%10d %10lu %10lu %12.3f %12.3f %10lu\n", i,
+            sub->received, dropped,
+            sub->received ? sub->lag_sum * 0.000001 / sub->received : 0.0,
+            sub->lag_max * 0.000001, sub->behind);
+    }
+    fprintf(stderr, "%d of %d subscribers dropped %lu of %lu messages\n",
+        droppers, num, total, ahead * num);
+    nc_hist_print(lag, stderr, "Lag", 1000000, "ms");
+}
+
+/*  Takes up to NC_FANOUT_BATCH messages that are ready on the subscriber,
+    returns -1 if the socket is terminated  */
+int nc_fanout_drain(nc_options_t *options, struct nc_stats *stats,
+                    struct nc_subscriber *sub, int print,
+                    uint64_t *arrivals, unsigned long *ahead,
+                    struct nc_histogram *lag)
+{
+    uint64_t now;
+    uint64_t delay;
+    void *buf;
+    int len;
+    int rc;
+    int i;
+
+    for(i = 0; i < NC_FANOUT_BATCH; ++i) {
+        rc = nn_recv(sub->sock, &buf, NN_MSG, NN_DONTWAIT);
+        if(rc < 0 && (errno == EAGAIN || errno == EWOULDBLOCK)) {
+            break;
+        } else if(rc < 0 && errno == ETERM) {
+            return -1;
+        }
+        nc_assert_errno(rc >= 0, "Can't recv");
+        now = nc_clock_ns();
+        len = stats->checksum ? nc_stats_checksum(stats, buf, rc) : rc;
+        if(len >= 0) {
+            nc_stats_received(stats, len);
+            if(print && stats->topk) {
+                nc_stats_topics(stats, buf, len);
+            }
+        }
+        if(sub->received == *ahead) {
+            /*  The leader has no lag, it would only dilute the histogram  */
+            arrivals[*ahead % NC_FANOUT_WINDOW] = now;
+            *ahead += 1;
+        } else if(*ahead - sub->received <= NC_FANOUT_WINDOW) {
+            delay = now - arrivals[sub->received % NC_FANOUT_WINDOW];
+            sub->lag_sum += delay;
+            if(delay > sub->lag_max) {
+                sub->lag_max = delay;
+            }
+            nc_hist_add(lag, delay);
+        } else {
+            sub->behind += 1;
+        }
+        sub->received += 1;
+        if(print && len >= 0) {
+            nc_print_message(options, stats, buf, len);
+        }
+        nn_freemsg(buf);
+    }
+    return 0;
+}
+
+/*  Receives with --fanout subscribers, ``sock`` being the first of them.
+    Messages of the first subscriber are printed, --count applies to the
+    subscriber that is ahead  */
+void nc_fanout_loop(nc_options_t *options, int sock,
+                    struct nc_stats *stats) {
+    struct nc_subscriber *subs;
+    struct nn_pollfd *fds;
+    struct nc_histogram lag;
+    uint64_t *arrivals;
+    unsigned long ahead;
+    uint64_t idle;
+    double timeout;
+    double wait;
+    int num;
+    int rc;
+    int i;
+
+    if(options->bind_addresses.num) {
+        fprintf(stderr, "Subscribers of --fanout can't --bind, "
+            "use --connect\n");
+        exit(1);
+    }
+    if(options->max_msg_size > 0 || options->busy_poll ||
+       options->format_threads > 0) {
+        fprintf(stderr, "Options --max-msg-size, --busy-poll and "
+            "--format-threads are not supported with --fanout\n");
+        exit(1);
+    }
+    if(options->dedup) {
+        fprintf(stderr, "Option --dedup is not supported with --fanout, "
+            "its subscribers receive the same messages\n");
+        exit(1);
+    }
+    num = options->fanout;
+    subs = calloc(num, sizeof(struct nc_subscriber));
+    fds = calloc(num, sizeof(struct nn_pollfd));
+    arrivals = malloc(NC_FANOUT_WINDOW * sizeof(uint64_t));
+    nc_assert_errno(subs && fds && arrivals, "Can't allocate subscribers");
+    for(i = 0; i < num; ++i) {
+        if(i == 0) {
+            subs[i].sock = sock;
+        } else {
+            subs[i].sock = nc_create_socket(options);
+            nc_connect_socket(options, subs[i].sock);
+        }
+        fds[i].fd = subs[i].sock;
+        fds[i].events = NN_POLLIN;
+    }
+    nc_hist_reset(&lag);
+    ahead = 0;
+    idle = nc_clock_ns();
+
+    for(;;) {
+        if(nc_stats_over(options, stats, ahead)) {
+            break;
+        }
+        timeout = nc_stats_timeout(stats, nc_stats_recv_left(options, idle));
+        wait = nc_stats_topk_timeout(stats, timeout);
+        rc = nn_poll(fds, num, wait < 0 ? -1 : (int)(wait * 1000 + 0.999));
+        if(rc < 0 && errno == ETERM) {
+            break;  /*  Stopped by a signal  */
+        }
+        nc_assert_errno(rc >= 0, "Can't poll");
+        if(rc == 0 && (timeout < 0 || wait < timeout)) {
+            nc_stats_topk_report(stats);
+            continue;
+        } else if(rc == 0) {
+            break;  /*  No more messages possible  */
+        }
+        idle = nc_clock_ns();
+        for(i = 0; i < num; ++i) {
+            if(fds[i].revents & NN_POLLIN) {
+                rc = nc_fanout_drain(options, stats, &subs[i], i == 0,
+                                     arrivals, &ahead, &lag);
+                if(rc < 0) {
+                    break;
+                }
+            }
+        }
+        if(rc < 0) {
+            break;  /*  Stopped by a signal  */
+        }
+    }
+
+    nc_fanout_print(subs, num, ahead, &lag);
+    for(i = 1; i < num; ++i) {
+        nn_close(subs[i].sock);
+    }
+    free(arrivals);
+    free(fds);
+    free(subs);
+}
+
+void nc_rw_loop(nc_options_t *options, int sock, struct nc_stats *stats) {
+    int rc;
+    void *buf;
+    void *buffer;
+    double start_time, time_to_sleep;
+
+    buffer = nc_alloc_recv_buffer(options);
+    for(;;) {
+        if(nc_stats_over(options, stats, stats->sent)) {
+            break;
+        }
+        nc_stats_topk_report(stats);  /*  if no message came to print it  */
+        start_time = nc_time();
+        rc = nn_send(sock,
+            options->data_to_send.data, options->data_to_send.length,
+            0);
+        if(rc < 0 && (errno == EAGAIN || errno == EWOULDBLOCK)) {
+            fprintf(stderr, "Message not sent (EAGAIN)\n");
+        } else if(rc < 0 && errno == ETERM) {
+            break;  /*  Stopped by a signal  */
+        } else {
+            nc_assert_errno(rc >= 0, "Can't send");
+            nc_stats_sent(stats, rc);
+        }
+        if(options->send_interval < 0 && (!nc_has_limits(options) ||
+           (options->socket_type != NN_REQ &&
+            options->socket_type != NN_SURVEYOR))) {
+            /*  Never send any more, limits of BUS and PAIR apply to
+                received messages  */
+            free(buffer);
+            nc_recv_loop(options, sock, stats);
+            return;
+        }
+        if(options->send_interval < 0) {
+            /*  Wait for the reply, or for the survey to end, before
+                sending the next request  */
+            for(;;) {
+                rc = nc_stats_recv(options, stats, sock, &buf, buffer);
+                if(rc < 0 && (errno == EAGAIN || errno == EWOULDBLOCK ||
+                              errno == ETIMEDOUT || errno == EFSM ||
+                              errno == ETERM)) {
+                    break;
+                }
+                nc_assert_errno(rc >= 0, "Can't recv");
+                nc_print_message(options, stats, buf, rc);
+                nc_free_msg(buf, buffer);
+                if(options->socket_type == NN_REQ) {
+                    break;
+                }
+            }
+            continue;
+        }
+
+        for(;;) {
+            time_to_sleep = (start_time + options->send_interval) - nc_time();
+            if(time_to_sleep <= 0) {
+                break;
+            }
+            time_to_sleep = nc_stats_timeout(stats, time_to_sleep);
+            if(time_to_sleep <= 0) {
+                break;  /*  --duration is over  */
+            }
+            if(options->recv_timeout >= 0 &&
+                time_to_sleep > options->recv_timeout)
+            {
+                time_to_sleep = options->recv_timeout;
+            }
+            nc_set_recv_timeout(sock, time_to_sleep);
+            stats->timeout_ms = (int)(time_to_sleep * 1000);
+            rc = nc_recv_msg(options, sock, &buf, buffer, time_to_sleep);
+            if(rc < 0) {
+                if(errno == EAGAIN || errno == EWOULDBLOCK) {
+                    continue;
+                } else if(errno == ETERM) {
+                    break;
+                } else if(errno == ETIMEDOUT || errno == EFSM) {
+                    time_to_sleep = (start_time + options->send_interval) \
+                        - nc_time();
+                    if(time_to_sleep > 0)
+                        nc_sleep(nc_stats_timeout(stats, time_to_sleep));
+                    continue;
+                }
+            }
+            nc_assert_errno(rc >= 0, "Can't recv");
+            rc = nc_stats_accept(stats, buf, rc);
+            if(rc >= 0) {
+                nc_print_message(options, stats, buf, rc);
+            }
+            nc_free_msg(buf, buffer);
+        }
+    }
+    free(buffer);
+}
+
+/*  Statistics for --survey-stats, latencies are in nanoseconds  */
+struct nc_survey_stats {
+    unsigned long surveys;
+    unsigned long stragglers;
+    struct nc_histogram responses;  /*  on-time responses per survey  */
+    struct nc_histogram latency;  /*  of every response  */
+    struct nc_histogram completion;  /*  of the last on-time response  */
+};
+
+void nc_print_survey_stats(struct nc_survey_stats *stats) {
+    fprintf(stderr, "%lu surveys, %lu stragglers\n",
+        stats->surveys, stats->stragglers);
+    nc_hist_print(&stats->responses, stderr,
+        "Responses per survey", 1, "");
+    nc_hist_print(&stats->latency, stderr,
+        "Response latency", 1000000, "ms");
+    nc_hist_print(&stats->completion, stderr,
+        "Last on-time response", 1000000, "ms");
+}
+
+/*  SURVEYOR loop for --survey-stats. Per-response work is just a few
+    counters and histogram updates, so that fan-in of thousands of
+    respondents is measured rather than slowed down by nanocat  */
+void nc_survey_loop(nc_options_t *options, int sock,
+                    struct nc_stats *stats) {
+    struct nc_survey_stats survey;
+    void *buf;
+    void *buffer;
+    uint64_t start, latency, deadline, window;
+    uint64_t first, last;
+    unsigned long responses, stragglers;
+    double time_to_sleep;
+    int millis;
+    int rc;
+
+    /*  nanomsg drops responses after the socket's deadline, so keep it
+        open until the next survey to be able to see stragglers  */
+    deadline = (uint64_t)(options->survey_deadline * 1000000000.0);
+    if(options->send_interval > options->survey_deadline) {
+        window = (uint64_t)(options->send_interval * 1000000000.0);
+    } else {
+        window = 2 * deadline;
+    }
+    millis = (int)(window / 1000000);
+    rc = nn_setsockopt(sock, NN_SURVEYOR, NN_SURVEYOR_DEADLINE,
+                       &millis, sizeof(millis));
+    nc_assert_errno(rc == 0, "Can't set survey deadline");
+    /*  Every receive waits for the rest of the window, which the deadline
+        enforces, a shorter --recv-timeout would end the survey early and
+        report late responses as missing  */
+    if(options->recv_timeout >= 0) {
+        millis = -1;
+        rc = nn_setsockopt(sock, NN_SOL_SOCKET, NN_RCVTIMEO,
+                           &millis, sizeof(millis));
+        nc_assert_errno(rc == 0, "Can't set recv timeout");
+    }
+
+    memset(&survey, 0, sizeof(survey));
+    buffer = nc_alloc_recv_buffer(options);
+    for(;;) {
+        if(nc_stats_over(options, stats, stats->sent)) {
+            break;
+        }
+        nc_stats_topk_report(stats);  /*  if no message came to print it  */
+        start = nc_clock_ns();
+        rc = nn_send(sock,
+            options->data_to_send.data, options->data_to_send.length,
+            0);
+        if(rc < 0 && (errno == EAGAIN || errno == EWOULDBLOCK)) {
+            fprintf(stderr, "Message not sent (EAGAIN)\n");
+        } else if(rc < 0 && errno == ETERM) {
+            break;  /*  Stopped by a signal  */
+        } else {
+            nc_assert_errno(rc >= 0, "Can't send");
+            nc_stats_sent(stats, rc);
+        }
+
+        responses = 0;
+        stragglers = 0;
+        first = 0;
+        last = 0;
+        for(;;) {
+            latency = nc_clock_ns() - start;
+            rc = nc_recv_msg(options, sock, &buf, buffer,
+                latency < window ? (window - latency) * 0.000000001 : 0);
+            if(rc < 0 && (errno == EAGAIN || errno == EWOULDBLOCK)) {
+                continue;
+            } else if(rc < 0 && (errno == ETIMEDOUT || errno == EFSM ||
+                                 errno == ETERM)) {
+                break;  /*  Survey is over  */
+            }
+            nc_assert_errno(rc >= 0, "Can't recv");
+            rc = nc_stats_accept(stats, buf, rc);
+            if(rc < 0) {
+                nc_free_msg(buf, buffer);
+                continue;
+            }
+            latency = nc_clock_ns() - start;
+            nc_hist_add(&survey.latency, latency);
+            if(latency > deadline) {
+                stragglers += 1;
+            } else {
+                if(!responses) {
+                    first = latency;
+                }
+                last = latency;
+                responses += 1;
+            }
+            nc_print_message(options, stats, buf, rc);
+            nc_free_msg(buf, buffer);
+        }
+
+        survey.surveys += 1;
+        survey.stragglers += stragglers;
+        nc_hist_add(&survey.responses, responses);
+        if(responses) {
+            nc_hist_add(&survey.completion, last);
+        }
+        fprintf(stderr, "Survey %lu: %lu responses, first %.3f ms, "
+            "last %.3f ms, %lu stragglers\n", survey.surveys, responses,
+            first * 0.000001, last * 0.000001, stragglers);
+
+        if(options->send_interval < 0) {
+            if(!nc_has_limits(options)) {
+                break;
+            }
+            continue;
+        }
+        time_to_sleep = options->send_interval -
+            (nc_clock_ns() - start) * 0.000000001;
+        if(time_to_sleep > 0) {
+            nc_sleep(nc_stats_timeout(stats, time_to_sleep));
+        }
+    }
+    nc_print_survey_stats(&survey);
+    free(buffer);
+}
+
+void nc_resp_loop(nc_options_t *options, int sock,
+                  struct nc_stats *stats) {
+    int rc;
+    void *buf;
+    void *buffer;
+
+    buffer = nc_alloc_recv_buffer(options);
+    for(;;) {
+        if(nc_stats_over(options, stats, stats->received)) {
+            break;
+        }
+        rc = nc_stats_recv(options, stats, sock, &buf, buffer);
+        if(rc < 0 && (errno == EAGAIN || errno == EWOULDBLOCK)) {
+                continue;
+        } else if(rc < 0 && (errno == ETIMEDOUT || errno == ETERM) &&
+                  nc_stats_over(options, stats, stats->received)) {
+            break;
+        } else {
+            nc_assert_errno(rc >= 0, "Can't recv");
+        }
+        nc_print_message(options, stats, buf, rc);
+        nc_free_msg(buf, buffer);
+        rc = nn_send(sock,
+            options->data_to_send.data, options->data_to_send.length,
+            0);
+        if(rc < 0 && (errno == EAGAIN || errno == EWOULDBLOCK)) {
+            fprintf(stderr, "Message not sent (EAGAIN)\n");
+        } else if(rc < 0 && errno == ETERM) {
+            break;  /*  Stopped by a signal  */
+        } else {
+            nc_assert_errno(rc >= 0, "Can't send");
+            nc_stats_sent(stats, rc);
+        }
+    }
+    free(buffer);
+}
+
+/*  Maximum number of requests written to the --handler and not yet replied  */
+#define NC_HANDLER_INFLIGHT 1024
+
+/*  A --handler process. Replies come in the order of requests, so the
+    headers that route every reply back to its requester are kept in
+    a ring, pushed by the receiving thread and popped by the thread
+    reading the replies  */
+struct nc_handler {
+    unsigned long head;
+    char pad1[NC_CACHELINE - sizeof(unsigned long)];
+    unsigned long tail;
+    char pad2[NC_CACHELINE - sizeof(unsigned long)];
+    int sock;
+    pid_t pid;
+    FILE *input;
+    FILE *output;
+    pthread_t thread;
+    unsigned long stopping;
+    struct nc_stats stats;  /*  replies, owned by the reply thread  */
+    void *headers[NC_HANDLER_INFLIGHT];
+};
+
+void *nc_handler_thread(void *arg) {
+    struct nc_handler *handler = arg;
+    struct nn_msghdr hdr;
+    struct nn_iovec iov;
+    unsigned char prefix[4];
+    unsigned long tail;
+    size_t len;
+    void *msg;
+    int rc;
+
+    tail = handler->tail;
+    for(;;) {
+        if(fread(prefix, 1, 4, handler->output) != 4) {
+            break;
+        }
+        len = nc_get_be(prefix, 4);
+        msg = nn_allocmsg(handler->stats.checksum ? len + 4 : len, 0);
+        nc_assert_errno(msg != NULL, "Can't allocate reply");
+        if(fread(msg, 1, len, handler->output) != len) {
+            break;
+        }
+        if(handler->stats.checksum) {
+            nc_put_checksum(msg, len);
+            len += 4;
+        }
+        if(tail == nc_load(&handler->head)) {
+            fprintf(stderr, "Handler replied without a request\n");
+            exit(3);
+        }
+
+        iov.iov_base = &msg;
+        iov.iov_len = NN_MSG;
+        memset(&hdr, 0, sizeof(hdr));
+        hdr.msg_iov = &iov;
+        hdr.msg_iovlen = 1;
+        hdr.msg_control = &handler->headers[tail % NC_HANDLER_INFLIGHT];
+        hdr.msg_controllen = NN_MSG;
+        rc = nn_sendmsg(handler->sock, &hdr, 0);
+        if(rc < 0 && (errno == EAGAIN || errno == EWOULDBLOCK ||
+                      errno == ETERM)) {
+            if(errno != ETERM) {
+                fprintf(stderr, "Message not sent (EAGAIN)\n");
+            }
+            nn_freemsg(msg);
+            nn_freemsg(handler->headers[tail % NC_HANDLER_INFLIGHT]);
+        } else {
+            nc_assert_errno(rc >= 0, "Can't send");
+            nc_stats_sent(&handler->stats, len);
+        }
+        tail += 1;
+        nc_store(&handler->tail, tail);
+    }
+    if(nc_load(&handler->stopping)) {
+        return NULL;
+    }
+    fprintf(stderr, "Handler exited\n");
+    exit(3);
+}
+
+struct nc_handler *nc_handler_start(nc_options_t *options, int sock) {
+    struct nc_handler *handler;
+    sigset_t signals;
+    int input[2];
+    int output[2];
+    int rc;
+
+    handler = malloc(sizeof(struct nc_handler));
+    nc_assert_errno(handler != NULL, "Can't allocate handler");
+    memset(handler, 0, sizeof(struct nc_handler));
+    handler->sock = sock;
+    nc_stats_start(options, &handler->stats);
+
+    rc = pipe(input);
+    nc_assert_errno(rc == 0, "Can't create pipe");
+    rc = pipe(output);
+    nc_assert_errno(rc == 0, "Can't create pipe");
+    /*  If the handler dies it's reported by the reply thread instead  */
+    signal(SIGPIPE, SIG_IGN);
+    handler->pid = fork();
+    nc_assert_errno(handler->pid >= 0, "Can't start handler");
+    if(handler->pid == 0) {
+        dup2(input[0], 0);
+        dup2(output[1], 1);
+        close(input[0]);
+        close(input[1]);
+        close(output[0]);
+        close(output[1]);
+        /*  Handler is stopped by closing its input, even on Ctrl+C  */
+        signal(SIGINT, SIG_IGN);
+        signal(SIGPIPE, SIG_DFL);
+        sigemptyset(&signals);
+        pthread_sigmask(SIG_SETMASK, &signals, NULL);
+        execl("/bin/sh", "sh", "-c", options->handler, (char *)NULL);
+        perror("Can't execute handler");
+        _exit(127);
+    }
+    close(input[0]);
+    close(output[1]);
+
+    handler->input = fdopen(input[1], "w");
+    nc_assert_errno(handler->input != NULL, "Can't open handler input");
+    handler->output = fdopen(output[0], "r");
+    nc_assert_errno(handler->output != NULL, "Can't open handler output");
+    setvbuf(handler->input, NULL, _IOFBF, NC_OUTBUF_SIZE);
+    setvbuf(handler->output, NULL, _IOFBF, NC_OUTBUF_SIZE);
+
+    rc = pthread_create(&handler->thread, NULL, nc_handler_thread, handler);
+    errno = rc;
+    nc_assert_errno(rc == 0, "Can't start handler thread");
+    return handler;
+}
+
+/*  Waits for replies to all requests and lets the handler exit at the end
+    of its input  */
+void nc_handler_stop(struct nc_handler *handler, struct nc_stats *stats) {
+    int spins;
+    int rc;
+
+    rc = fflush(handler->input);
+    nc_assert_errno(rc == 0, "Can't write to handler");
+    spins = 0;
+    while(nc_load(&handler->tail) != handler->head && !nc_is_stopping()) {
+        nc_backoff(&spins);
+    }
+    nc_store(&handler->stopping, 1);
+    fclose(handler->input);
+    pthread_join(handler->thread, NULL);
+    waitpid(handler->pid, NULL, 0);
+    fclose(handler->output);
+    nc_stats_stop(&handler->stats);
+    nc_stats_merge(stats, &handler->stats);
+    free(handler);
+}
+
+/*  REP/RESPONDENT loop for --handler. Requests are written to the handler
+    as fast as they come and are only flushed when there is nothing more
+    to receive, so a busy handler gets them in large batches  */
+void nc_handler_loop(nc_options_t *options, int sock,
+                     struct nc_stats *stats) {
+    struct nc_handler *handler;
+    struct nn_msghdr hdr;
+    struct nn_iovec iov;
+    unsigned char prefix[4];
+    unsigned long head;
+    void *buf;
+    void *control;
+    int msglen;
+    int flags;
+    int spins;
+    int rc;
+
+    handler = nc_handler_start(options, sock);
+    head = 0;
+    flags = NN_DONTWAIT;
+    for(;;) {
+        if(nc_stats_over(options, stats, stats->received)) {
+            break;
+        }
+        if(!flags) {
+            nc_stats_update_timeout(options, stats, sock);
+        }
+        iov.iov_base = &buf;
+        iov.iov_len = NN_MSG;
+        memset(&hdr, 0, sizeof(hdr));
+        hdr.msg_iov = &iov;
+        hdr.msg_iovlen = 1;
+        hdr.msg_control = &control;
+        hdr.msg_controllen = NN_MSG;
+        rc = nn_recvmsg(sock, &hdr, flags);
+        if(rc < 0 && (errno == EAGAIN || errno == EWOULDBLOCK)) {
+            /*  Nothing more to batch, let the handler see the requests  */
+            if(flags) {
+                rc = fflush(handler->input);
+                nc_assert_errno(rc == 0, "Can't write to handler");
+                if(!options->busy_poll) {
+                    flags = 0;
+                }
+            }
+            continue;
+        } else if(rc < 0 && (errno == ETIMEDOUT || errno == ETERM) &&
+                  nc_stats_over(options, stats, stats->received)) {
+            break;
+        } else {
+            nc_assert_errno(rc >= 0, "Can't recv");
+        }
+        flags = NN_DONTWAIT;
+        msglen = nc_stats_accept(stats, buf, rc);
+        if(msglen < 0) {
+            nn_freemsg(control);
+            nn_freemsg(buf);
+            continue;
+        }
+        nc_print_message(options, stats, buf, msglen);
+
+        spins = 0;
+        while(head - nc_load(&handler->tail) >= NC_HANDLER_INFLIGHT) {
+            rc = fflush(handler->input);
+            nc_assert_errno(rc == 0, "Can't write to handler");
+            nc_backoff(&spins);
+        }
+        handler->headers[head % NC_HANDLER_INFLIGHT] = control;
+        head += 1;
+        nc_store(&handler->head, head);
+
+        prefix[0] = (unsigned char)(msglen >> 24);
+        prefix[1] = (unsigned char)(msglen >> 16);
+        prefix[2] = (unsigned char)(msglen >> 8);
+        prefix[3] = (unsigned char)msglen;
+        if(fwrite(prefix, 1, 4, handler->input) != 4 ||
+            fwrite(buf, 1, msglen, handler->input) != (size_t)msglen) {
+            nc_assert_errno(0, "Can't write to handler");
+        }
+        nn_freemsg(buf);
+    }
+    nc_handler_stop(handler, stats);
+}
+
+nc_options_t nc_default_options = {
+    .verbose = 0,
+    .spec_path = NULL,
+    .count = 0,
+    .duration = -1.f,
+    .checksum = 0,
+    .socket_type = 0,
+    .bind_addresses = {NULL, 0},
+    .connect_addresses = {NULL, 0},
+    .send_timeout = -1.f,
+    .send_interval = -1.f,
+    .wait_peers = 0,
+    .wait_timeout = -1.f,
+    .recv_timeout = -1.f,
+    .subscriptions = {NULL, 0},
+    .fanout = 0,
+    .shard_key = NULL,
+    .shard_delim = NULL,
+    .shard_batch = 1,
+    .survey_stats = 0,
+    .survey_deadline = 1.f,
+    .max_msg_size = 0,
+    .sndbuf = -1,
+    .rcvbuf = -1,
+    .linger = -1.f,
+    .sndprio = 0,
+    .rcvprio = 0,
+    .reconnect_ivl = -1.f,
+    .tcp_nodelay = 0,
+    .sweep_size = 0,
+    .selftest_bench = 0,
+    .connections = 0,
+    .churn_rate = 0.f,
+    .busy_poll = 0,
+    .cpu = -1,
+    .fifo_priority = 0,
+    .data_to_send = {NULL, 0},
+    .handler = NULL,
+    .echo_format = NC_NO_ECHO,
+    .decode_format = NC_NO_DECODE,
+    .format_threads = 0,
+    .dedup = 0,
+    .dedup_time = -1.f,
+    .dedup_key = NULL,
+    .topk = 0,
+    .topic_delim = NULL,
+    .topk_interval = 1.f,
+    .output_path = NULL,
+    .rotate_size = 0,
+    .rotate_interval = 0.f,
+    .shm_ring = NULL,
+    .shm_size = 16777216,
+    .shm_full = NC_SHM_BLOCK
+    };
+
+/*  Signals are blocked in all threads and received by this one, so that
+    stopping (nn_term) and printing stats happen outside of a signal
+    handler  */
+void *nc_signal_thread(void *arg) {
+    sigset_t *signals = arg;
+    struct nc_stats *stats;
+    int sig;
+
+    for(;;) {
+        if(sigwait(signals, &sig) != 0) {
+            continue;
+        }
+        if(sig == SIGUSR1) {
+            pthread_mutex_lock(&nc_running_lock);
+            for(stats = nc_running_stats; stats; stats = stats->next) {
+                nc_stats_print(stats);
+            }
+            pthread_mutex_unlock(&nc_running_lock);
+            continue;
+        }
+        if(nc_is_stopping()) {
+            fprintf(stderr, "Terminated\n");
+            exit(1);  /*  Second signal doesn't wait for the loops  */
+        }
+        pthread_mutex_lock(&nc_stop_lock);
+        __atomic_store_n(&nc_stopping, 1, __ATOMIC_RELEASE);
+        pthread_cond_broadcast(&nc_stop_cond);
+        pthread_mutex_unlock(&nc_stop_lock);
+        nn_term();
+    }
+}
+
+/*  Must be called before any thread is started  */
+void nc_start_signal_thread() {
+    static sigset_t signals;
+    pthread_t thread;
+    int rc;
+
+    sigemptyset(&signals);
+    sigaddset(&signals, SIGINT);
+    sigaddset(&signals, SIGTERM);
+    sigaddset(&signals, SIGUSR1);
+    nc_stop_init();
+    rc = pthread_sigmask(SIG_BLOCK, &signals, NULL);
+    errno = rc;
+    nc_assert_errno(rc == 0, "Can't block signals");
+    rc = pthread_create(&thread, NULL, nc_signal_thread, &signals);
+    errno = rc;
+    nc_assert_errno(rc == 0, "Can't start signal thread");
+    pthread_detach(thread);
+}
+
+void nc_run_socket(nc_options_t *options, int sock) {
+    struct nc_stats stats;
+
+    if(options->wait_peers > 0) {
+        nc_wait_peers(options, sock);
+    }
+    nc_stats_start(options, &stats);
+    switch(options->socket_type) {
+    case NN_PUB:
+        nc_send_loop(options, sock, &stats);
+        break;
+    case NN_PUSH:
+        if(options->shard_key) {
+            nc_shard_loop(options, sock, &stats);
+        } else {
+            nc_send_loop(options, sock, &stats);
+        }
+        break;
+    case NN_SUB:
+        if(options->fanout > 1) {
+            nc_fanout_loop(options, sock, &stats);
+        } else {
+            nc_recv_loop(options, sock, &stats);
+        }
+        break;
+    case NN_PULL:
+        nc_recv_loop(options, sock, &stats);
+        break;
+    case NN_BUS:
+    case NN_PAIR:
+        if(options->data_to_send.data) {
+            nc_rw_loop(options, sock, &stats);
+        } else {
+            nc_recv_loop(options, sock, &stats);
+        }
+        break;
+    case NN_SURVEYOR:
+        if(options->survey_stats) {
+            nc_survey_loop(options, sock, &stats);
+        } else {
+            nc_rw_loop(options, sock, &stats);
+        }
+        break;
+    case NN_REQ:
+        nc_rw_loop(options, sock, &stats);
+        break;
+    case NN_REP:
+    case NN_RESPONDENT:
+        if(options->handler) {
+            nc_handler_loop(options, sock, &stats);
+        } else if(options->data_to_send.data) {
+            nc_resp_loop(options, sock, &stats);
+        } else {
+            nc_recv_loop(options, sock, &stats);
+        }
+        break;
+    }
+    nc_stats_stop(&stats);
+    if(nc_has_limits(options) || nc_is_stopping()) {
+        nc_stats_print(&stats);
+    }
+}
+
+/*  Buffer sizes tried by --sweep-buffers for both NN_SNDBUF and NN_RCVBUF  */
+static const int nc_sweep_sizes[] = {
+    16384, 65536, 262144, 1048576, 4194304, 16777216, 0};
+#define NC_SWEEP_WARMUP 0.1  /*  seconds before measuring every run  */
+#define NC_SWEEP_TIME 0.5  /*  seconds measured for every run  */
+
+struct nc_sweep_sender {
+    int sock;
+    int size;
+    int stop;
+};
+
+void *nc_sweep_sender_thread(void *arg) {
+    struct nc_sweep_sender *sender = arg;
+    char *buf;
+    int rc;
+
+    buf = calloc(1, sender->size);
+    nc_assert_errno(buf != NULL, "Can't allocate message");
+    while(!__atomic_load_n(&sender->stop, __ATOMIC_ACQUIRE)) {
+        rc = nn_send(sender->sock, buf, sender->size, 0);
+        if(rc < 0 && (errno == EAGAIN || errno == ETIMEDOUT)) {
+            continue;
+        } else if(rc < 0 && errno == ETERM) {
+            break;  /*  Stopped by a signal  */
+        }
+        nc_assert_errno(rc >= 0, "Can't send");
+    }
+    free(buf);
+    return NULL;
+}
+
+/*  Returns messages per second received from PUSH to PULL over the address
+    with the given buffer sizes, or -1 if stopped by a signal  */
+double nc_sweep_run(nc_options_t *options, char *address,
+                    int sndbuf, int rcvbuf) {
+    nc_options_t sockopts = *options;
+    struct nc_sweep_sender sender;
+    pthread_t thread;
+    unsigned long count;
+    double start;
+    double now;
+    void *buf;
+    int pull;
+    int rc;
+
+    /*  Timeouts let both loops notice the end of the run  */
+    sockopts.send_timeout = 0.1;
+    sockopts.recv_timeout = 0.1;
+    sockopts.sndbuf = sndbuf;
+    sockopts.rcvbuf = rcvbuf;
+    sockopts.socket_type = NN_PULL;
+    pull = nc_create_socket(&sockopts);
+    rc = nn_bind(pull, address);
+    nc_assert_errno(rc >= 0, "Can't bind");
+    sockopts.socket_type = NN_PUSH;
+    sender.sock = nc_create_socket(&sockopts);
+    rc = nn_connect(sender.sock, address);
+    nc_assert_errno(rc >= 0, "Can't connect");
+    sender.size = options->sweep_size;
+    sender.stop = 0;
+    rc = pthread_create(&thread, NULL, nc_sweep_sender_thread, &sender);
+    errno = rc;
+    nc_assert_errno(rc == 0, "Can't start sender thread");
+
+    count = 0;
+    start = nc_time() + NC_SWEEP_WARMUP;
+    for(;;) {
+        rc = nn_recv(pull, &buf, NN_MSG, 0);
+        if(rc < 0 && (errno == EAGAIN || errno == ETIMEDOUT)) {
+            now = nc_time();
+        } else if(rc < 0 && errno == ETERM) {
+            break;
+        } else {
+            nc_assert_errno(rc >= 0, "Can't recv");
+            nn_freemsg(buf);
+            now = nc_time();
+            if(now >= start) {
+                count += 1;
+            }
+        }
+        if(now >= start + NC_SWEEP_TIME) {
+            break;
+        }
+    }
+
+    __atomic_store_n(&sender.stop, 1, __ATOMIC_RELEASE);
+    pthread_join(thread, NULL);
+    nn_close(sender.sock);
+    nn_close(pull);
+    if(nc_is_stopping()) {
+        return -1;
+    }
+    return count / (now - start);
+}
+
+void nc_sweep_buffers(nc_options_t *options) {
+    const int *sndbuf;
+    const int *rcvbuf;
+    char *address;
+    double rate;
+    double best_rate;
+    int best_sndbuf;
+    int best_rcvbuf;
+
+    if(options->bind_addresses.num) {
+        address = options->bind_addresses.items[0];
+    } else {
+        address = options->connect_addresses.items[0];
+    }
+    best_rate = -1;
+    best_sndbuf = 0;
+    best_rcvbuf = 0;
+    printf("%10s %10s %12s %10s\n", "SNDBUF", "RCVBUF", "msg/s", "MB/s");
+    rate = 0;
+    for(sndbuf = nc_sweep_sizes; *sndbuf && rate >= 0; ++sndbuf) {
+        for(rcvbuf = nc_sweep_sizes; *rcvbuf; ++rcvbuf) {
+            rate = nc_sweep_run(options, address, *sndbuf, *rcvbuf);
+            if(rate < 0) {
+                break;  /*  Stopped by a signal  */
+            }
+            printf("%10d %10d %12.0f %10.1f\n", *sndbuf, *rcvbuf,
+                rate, rate * options->sweep_size / 1048576);
+            fflush(stdout);
+            if(rate > best_rate) {
+                best_rate = rate;
+                best_sndbuf = *sndbuf;
+                best_rcvbuf = *rcvbuf;
+            }
+        }
+    }
+    if(best_rate >= 0) {
+        printf("Best for %ld-byte messages: --sndbuf %d --rcvbuf %d "
+            "(%.0f msg/s)\n", options->sweep_size,
+            best_sndbuf, best_rcvbuf, best_rate);
+    }
+}
+
+/*  Socket pairings of --selftest-bench. The first socket binds and the
+    second one connects. One-way pairings stream from the connecting
+    socket, the others are driven as request and reply by this thread  */
+struct nc_selftest_pair {
+    int bound;
+    int connected;
+    int request_reply;
+};
+
+static const struct nc_selftest_pair nc_selftest_pairs[] = {
+    {NN_PULL, NN_PUSH, 0},
+    {NN_SUB, NN_PUB, 0},
+    {NN_PAIR, NN_PAIR, 0},
+    {NN_BUS, NN_BUS, 0},
+    {NN_REP, NN_REQ, 1},
+    {NN_RESPONDENT, NN_SURVEYOR, 1},
+    {0, 0, 0}};
+static const char *nc_selftest_transports[] = {"inproc", "ipc", "tcp", NULL};
+static const int nc_selftest_sizes[] = {64, 1024, 65536, 0};
+#define NC_SELFTEST_PORT 25560  /*  first TCP port, one per run  */
+
+/*  Peer thread: streams timestamped messages or echoes requests  */
+struct nc_selftest_peer {
+    int sock;
+    int size;
+    int echo;
+    int stop;
+};
+
+void *nc_selftest_peer_thread(void *arg) {
+    struct nc_selftest_peer *peer = arg;
+    uint64_t now;
+    char *buf;
+    void *msg;
+    int rc;
+
+    buf = calloc(1, peer->size);
+    nc_assert_errno(buf != NULL, "Can't allocate message");
+    while(!__atomic_load_n(&peer->stop, __ATOMIC_ACQUIRE)) {
+        if(peer->echo) {
+            rc = nn_recv(peer->sock, &msg, NN_MSG, 0);
+            if(rc >= 0) {
+                rc = nn_send(peer->sock, &msg, NN_MSG, 0);
+                if(rc < 0) {
+                    nn_freemsg(msg);
+                }
+            }
+        } else {
+            now = nc_clock_ns();
+            memcpy(buf, &now, sizeof(now));
+            rc = nn_send(peer->sock, buf, peer->size, 0);
+        }
+        if(rc < 0 && (errno == EAGAIN || errno == ETIMEDOUT ||
+                      errno == EFSM)) {
+            continue;
+        } else if(rc < 0 && errno == ETERM) {
+            break;  /*  Stopped by a signal  */
+        }
+        nc_assert_errno(rc >= 0, peer->echo ? "Can't reply" : "Can't send");
+    }
+    free(buf);
+    return NULL;
+}
+
+const char *nc_socket_name(int type) {
+    struct nc_enum_item *item;
+
+    for(item = socket_types; item->name; ++item) {
+        if(item->value == type) {
+            return item->name;
+        }
+    }
+    return "?";
+}
+
+/*  Runs a single pairing, returns messages (or round trips) per second
+    and fills ``latency`` with one-way (or round-trip) latency in ns.
+    Returns -1 if stopped by a signal  */
+double nc_selftest_run(nc_options_t *options,
+                       const struct nc_selftest_pair *pair,
+                       char *address, int size,
+                       struct nc_histogram *latency)
+{
+    nc_options_t sockopts = *options;
+    struct nc_selftest_peer peer;
+    pthread_t thread;
+    unsigned long count;
+    uint64_t sent;
+    uint64_t stamp;
+    double start;
+    double now;
+    char *request;
+    void *buf;
+    int sock;
+    int rc;
+
+    /*  Timeouts let both loops notice the end of the run  */
+    sockopts.send_timeout = 0.1;
+    sockopts.recv_timeout = 0.1;
+    if(sockopts.linger < 0) {
+        sockopts.linger = 0;
+    }
+    sockopts.socket_type = pair->bound;
+    sock = nc_create_socket(&sockopts);
+    rc = nn_bind(sock, address);
+    nc_assert_errno(rc >= 0, "Can't bind");
+    sockopts.socket_type = pair->connected;
+    peer.sock = nc_create_socket(&sockopts);
+    rc = nn_connect(peer.sock, address);
+    nc_assert_errno(rc >= 0, "Can't connect");
+
+    /*  This thread drives the connected REQ or SURVEYOR socket  */
+    if(pair->request_reply) {
+        rc = peer.sock;
+        peer.sock = sock;
+        sock = rc;
+    }
+    if(pair->connected == NN_SURVEYOR) {
+        nc_set_int_option(sock, NN_SURVEYOR, NN_SURVEYOR_DEADLINE, 100,
+                          "Can't set survey deadline");
+    }
+    peer.size = size;
+    peer.echo = pair->request_reply;
+    peer.stop = 0;
+    rc = pthread_create(&thread, NULL, nc_selftest_peer_thread, &peer);
+    errno = rc;
+    nc_assert_errno(rc == 0, "Can't start peer thread");
+
+    request = calloc(1, size);
+    nc_assert_errno(request != NULL, "Can't allocate message");
+    nc_hist_reset(latency);
+    count = 0;
+    start = nc_time() + NC_SWEEP_WARMUP;
+    for(;;) {
+        sent = nc_clock_ns();
+        if(pair->request_reply) {
+            rc = nn_send(sock, request, size, 0);
+            if(rc < 0 && errno == ETERM) {
+                break;
+            }
+            nc_assert_errno(rc >= 0 || errno == EAGAIN ||
+                            errno == ETIMEDOUT, "Can't send");
+        }
+        rc = nn_recv(sock, &buf, NN_MSG, 0);
+        now = nc_time();
+        if(rc < 0 && errno == ETERM) {
+            break;
+        } else if(rc >= 0) {
+            if(pair->request_reply) {
+                stamp = sent;
+            } else {
+                memcpy(&stamp, buf, sizeof(stamp));
+            }
+            if(now >= start) {
+                nc_hist_add(latency, nc_clock_ns() - stamp);
+                count += 1;
+            }
+            nn_freemsg(buf);
+        } else {
+            nc_assert_errno(errno == EAGAIN || errno == ETIMEDOUT ||
+                            errno == EFSM, "Can't recv");
+        }
+        if(now >= start + NC_SWEEP_TIME) {
+            break;
+        }
+    }
+
+    __atomic_store_n(&peer.stop, 1, __ATOMIC_RELEASE);
+    pthread_join(thread, NULL);
+    free(request);
+    nn_close(peer.sock);
+    nn_close(sock);
+    if(nc_is_stopping()) {
+        return -1;
+    }
+    return count / (now - start);
+}
+
+/*  Measures every pairing over every transport and message size in this
+    process, and prints a JSON object with a row per run  */
+void nc_selftest_bench(nc_options_t *options) {
+    const struct nc_selftest_pair *pair;
+    const char **transport;
+    const int *size;
+    struct nc_histogram latency;
+    char address[128];
+    char *sep;
+    double rate;
+    int run;
+
+    printf("{\"results\": [");
+    sep = "\n";
+    rate = 0;
+    run = 0;
+    for(pair = nc_selftest_pairs; pair->bound && rate >= 0; ++pair) {
+        for(transport = nc_selftest_transports; *transport && rate >= 0;
+            ++transport) {
+            for(size = nc_selftest_sizes; *size && rate >= 0;
+                ++size, ++run) {
+                if(!strcmp(*transport, "tcp")) {
+                    sprintf(address, "tcp://127.0.0.1:%d",
+                            NC_SELFTEST_PORT + run);
+                } else if(!strcmp(*transport, "ipc")) {
+                    sprintf(address, "ipc:///tmp/nanocat-selftest-%d-%d",
+                            (int)getpid(), run);
+                } else {
+                    sprintf(address, "inproc://selftest-%d", run);
+                }
+                rate = nc_selftest_run(options, pair, address, *size,
+                                       &latency);
+                if(!strcmp(*transport, "ipc")) {
+                    unlink(address + strlen("ipc://"));
+                }
+                if(rate < 0) {
+                    break;  /*  Stopped by a signal  */
+                }
+                printf("%s  {\"pair\": \"%s/%s\", \"transport\": \"%s\", "
+                    "\"size\": %d, \"msg_per_sec\": %.0f, "
+                    "\"mb_per_sec\": %.2f, \"latency\": \"%s\", "
+                    "\"latency_us\": {\"min\": %.1f, \"p50\": %.1f, "
+                    "\"p90\": %.1f, \"p99\": %.1f, \"max\": %.1f}}",
+                    sep, nc_socket_name(pair->connected),
+                    nc_socket_name(pair->bound), *transport, *size,
+                    rate, rate * *size / 1048576,
+                    pair->request_reply ? "round-trip" : "one-way",
+                    latency.min * 0.001,
+                    nc_hist_percentile(&latency, 50) * 0.001,
+                    nc_hist_percentile(&latency, 90) * 0.001,
+                    nc_hist_percentile(&latency, 99) * 0.001,
+                    latency.max * 0.001);
+                fflush(stdout);
+                sep = ",\n";
+            }
+        }
+    }
+    printf("\n]}\n");
+}
+
+/*  A socket of --connections. Socket types that send first (PUSH, REQ,
+    SURVEYOR) send --data as soon as the peer lets them, for the rest
+    the first message is the first one received  */
+struct nc_connection {
+    int sock;
+    int sending;  /*  waiting to send the first message  */
+    int established;  /*  got the first message  */
+    uint64_t opened;  /*  nc_clock_ns() before connecting  */
+};
+
+/*  Counters of --connections  */
+struct nc_storm {
+    unsigned long opened;
+    unsigned long established;
+    unsigned long failed;  /*  closed before the first message  */
+    struct nc_histogram first;  /*  connect to first message, in ns  */
+};
+
+void nc_connection_open(nc_options_t *options, struct nc_connection *conn,
+                        struct nn_pollfd *fd, struct nc_storm *storm)
+{
+    conn->sock = nc_create_socket(options);
+    conn->opened = nc_clock_ns();
+    nc_connect_socket(options, conn->sock);
+    conn->established = 0;
+    switch(options->socket_type) {
+    case NN_PUSH:
+    case NN_REQ:
+    case NN_SURVEYOR:
+        conn->sending = 1;
+        break;
+    default:
+        conn->sending = 0;
+        break;
+    }
+    fd->fd = conn->sock;
+    fd->events = conn->sending ? NN_POLLOUT : NN_POLLIN;
+    storm->opened += 1;
+}
+
+void nc_connection_established(struct nc_connection *conn,
+                               struct nc_storm *storm)
+{
+    if(!conn->established) {
+        conn->established = 1;
+        storm->established += 1;
+        nc_hist_add(&storm->first, nc_clock_ns() - conn->opened);
+    }
+}
+
+/*  Handles poll events of the connection, returns -1 if terminated  */
+int nc_connection_event(nc_options_t *options, struct nc_stats *stats,
+                        struct nc_connection *conn, struct nn_pollfd *fd,
+                        struct nc_storm *storm)
+{
+    void *buf;
+    int rc;
+
+    if(conn->sending && (fd->revents & NN_POLLOUT)) {
+        rc = nn_send(conn->sock, options->data_to_send.data,
+                     options->data_to_send.length, NN_DONTWAIT);
+        if(rc >= 0) {
+            nc_stats_sent(stats, rc);
+            conn->sending = 0;
+            if(options->socket_type == NN_REQ ||
+               options->socket_type == NN_SURVEYOR) {
+                fd->events = NN_POLLIN;  /*  first message is the reply  */
+            } else {
+                fd->events = 0;
+                nc_connection_established(conn, storm);
+            }
+        } else if(errno == ETERM) {
+            return -1;
+        } else {
+            nc_assert_errno(errno == EAGAIN, "Can't send");
+        }
+    }
+    if(fd->revents & NN_POLLIN) {
+        for(;;) {
+            rc = nn_recv(conn->sock, &buf, NN_MSG, NN_DONTWAIT);
+            if(rc < 0 && errno == ETERM) {
+                return -1;
+            } else if(rc < 0) {
+                /*  Survey may time out, REP may wait for a reply  */
+                nc_assert_errno(errno == EAGAIN || errno == ETIMEDOUT ||
+                                errno == EFSM, "Can't recv");
+                break;
+            }
+            nc_connection_established(conn, storm);
+            rc = nc_stats_accept(stats, buf, rc);
+            if(rc >= 0) {
+                nc_print_message(options, stats, buf, rc);
+            }
+            nn_freemsg(buf);
+        }
+    }
+    return 0;
+}
+
+/*  Opens --connections sockets and with --churn closes and reopens the
+    oldest one RATE times a second, measuring time from connect to the
+    first message. --count limits the number of reconnects  */
+void nc_run_connections(nc_options_t *options) {
+    struct nc_connection *conns;
+    struct nn_pollfd *fds;
+    struct nc_storm storm;
+    struct nc_stats stats;
+    unsigned long reconnects;
+    double interval;
+    double next_churn;
+    double timeout;
+    double now;
+    int num;
+    int next;
+    int rc;
+    int i;
+
+    if(options->bind_addresses.num) {
+        fprintf(stderr, "Sockets of --connections can't --bind, "
+            "use --connect\n");
+        exit(1);
+    }
+    if(options->socket_type == NN_PUB) {
+        /*  PUB is always writable, so it would measure poll latency  */
+        fprintf(stderr, "Option --connections doesn't support PUB, "
+            "it never waits for subscribers\n");
+        exit(1);
+    }
+    num = options->connections;
+    conns = calloc(num, sizeof(struct nc_connection));
+    fds = calloc(num, sizeof(struct nn_pollfd));
+    nc_assert_errno(conns && fds, "Can't allocate connections");
+    memset(&storm, 0, sizeof(storm));
+    nc_hist_reset(&storm.first);
+    nc_stats_start(options, &stats);
+    for(i = 0; i < num; ++i) {
+        nc_connection_open(options, &conns[i], &fds[i], &storm);
+    }
+
+    interval = options->churn_rate > 0 ? 1 / options->churn_rate : -1;
+    next_churn = nc_time() + interval;
+    reconnects = 0;
+    next = 0;
+    for(;;) {
+        if(nc_stats_over(options, &stats, reconnects)) {
+            break;
+        }
+        timeout = -1;
+        if(interval > 0) {
+            now = nc_time();
+            timeout = next_churn > now ? next_churn - now : 0;
+        }
+        timeout = nc_stats_timeout(&stats, timeout);
+        /*  Round up, so that the last millisecond isn't spent spinning  */
+        rc = nn_poll(fds, num,
+                     timeout < 0 ? -1 : (int)(timeout * 1000 + 0.999));
+        if(rc < 0 && errno == ETERM) {
+            break;  /*  Stopped by a signal  */
+        }
+        nc_assert_errno(rc >= 0, "Can't poll");
+        for(i = 0; i < num && rc >= 0; ++i) {
+            if(fds[i].revents) {
+                rc = nc_connection_event(options, &stats, &conns[i],
+                                         &fds[i], &storm);
+            }
+        }
+        if(rc < 0) {
+            break;  /*  Stopped by a signal  */
+        }
+
+        /*  Churn is paced from the schedule, not from the last one, so
+            the rate holds even if poll wakes up late  */
+        while(interval > 0 && nc_time() >= next_churn) {
+            if(!conns[next].established) {
+                storm.failed += 1;
+            }
+            nn_close(conns[next].sock);
+            nc_connection_open(options, &conns[next], &fds[next], &storm);
+            next = (next + 1) % num;
+            reconnects += 1;
+            next_churn += interval;
+        }
+    }
+
+    nc_stats_stop(&stats);
+    for(i = 0; i < num; ++i) {
+        if(!conns[i].established) {
+            storm.failed += 1;
+        }
+        nn_close(conns[i].sock);
+    }
+    fprintf(stderr, "Opened %lu connections (%lu reconnects), "
+        "%lu got the first message, %lu closed before it\n",
+        storm.opened, reconnects, storm.established, storm.failed);
+    nc_hist_print(&storm.first, stderr, "Connect to first message",
+                  1000000, "ms");
+    nc_stats_print(&stats);
+    free(fds);
+    free(conns);
+}
+
+/*  A socket declared in a --spec file. nanomsg with its worker threads is
+    shared by the whole process anyway, so every socket just runs its
+    usual loop in a thread of its own  */
+struct nc_instance {
+    nc_options_t options;
+    int sock;
+    pthread_t thread;
+};
+
+void *nc_instance_thread(void *arg) {
+    struct nc_instance *instance = arg;
+
+    nc_tune_thread(&instance->options);
+    if(instance->options.connections > 0) {
+        nc_run_connections(&instance->options);
+    } else {
+        nc_run_socket(&instance->options, instance->sock);
+    }
+    return NULL;
+}
+
+void nc_run_spec(nc_options_t *options) {
+    struct nc_spec *spec;
+    struct nc_instance *instances;
+    int i;
+    int rc;
+
+    spec = nc_spec_read(options->spec_path);
+    instances = calloc(spec->num, sizeof(struct nc_instance));
+    nc_assert_errno(instances != NULL, "Can't allocate sockets");
+
+    /*  Parse everything first, so a typo doesn't leave half of the sockets
+        running  */
+    for(i = 0; i < spec->num; ++i) {
+        instances[i].options = nc_default_options;
+        nc_parse_options(&nc_cli, &instances[i].options,
+                         spec->lines[i].argc, spec->lines[i].argv);
+        nc_checksum_data(&instances[i].options);
+        if(instances[i].options.spec_path ||
+           instances[i].options.output_path ||
+           instances[i].options.shm_ring) {
+            fprintf(stderr, "%s: Options --spec, --output and --shm-ring "
+                "are only allowed on the command-line\n",
+                spec->lines[i].argv[0]);
+            exit(1);
+        }
+    }
+
+    nc_output_shared = spec->num > 1;
+    for(i = 0; i < spec->num; ++i) {
+        instances[i].sock = -1;
+        if(instances[i].options.connections <= 0) {
+            instances[i].sock = nc_create_socket(&instances[i].options);
+            nc_connect_socket(&instances[i].options, instances[i].sock);
+        }
+        rc = pthread_create(&instances[i].thread, NULL,
+                            nc_instance_thread, &instances[i]);
+        errno = rc;
+        nc_assert_errno(rc == 0, "Can't start socket thread");
+    }
+    for(i = 0; i < spec->num; ++i) {
+        pthread_join(instances[i].thread, NULL);
+        if(instances[i].sock >= 0) {
+            nn_close(instances[i].sock);
+        }
+    }
+    free(instances);
+    nc_spec_free(spec);
+}
+
+int main(int argc, char **argv) {
+    int sock;
+    int rc;
+    nc_options_t options = nc_default_options;
+
+    nc_parse_options(&nc_cli, &options, argc, argv);
+    nc_crc32c_init();
+    nc_checksum_data(&options);
+    nc_start_signal_thread();
+    nc_clock_init();
+    if(options.output_path) {
+        nc_output.file = nc_filewriter_start(options.output_path,
+            options.rotate_size, options.rotate_interval);
+    } else {
+        nc_output.stream = stdout;
+    }
+    if(options.shm_ring) {
+        if(options.shm_size <= 0) {
+            fprintf(stderr, "%s: Option --shm-size must be positive\n",
+                    argv[0]);
+            exit(1);
+        }
+        rc = nc_shmring_create(&nc_shm, options.shm_ring, options.shm_size);
+        nc_assert_errno(rc == 0, "Can't create shared memory ring");
+        nc_shm_enabled = 1;
+        nc_shm_full = options.shm_full;
+    }
+    if(options.spec_path) {
+        nc_run_spec(&options);
+    } else if(options.sweep_size > 0) {
+        nc_sweep_buffers(&options);
+    } else if(options.selftest_bench) {
+        nc_selftest_bench(&options);
+    } else if(options.connections > 0) {
+        nc_run_connections(&options);
+    } else {
+        sock = nc_create_socket(&options);
+        nc_connect_socket(&options, sock);
+        nc_tune_thread(&options);
+        nc_run_socket(&options, sock);
+        nn_close(sock);
+    }
+
+    if(nc_output.file) {
+        nc_filewriter_stop(nc_output.file);
+    }
+    if(nc_shm_enabled) {
+        if(options.verbose && nc_shm.header->dropped) {
+            fprintf(stderr, "Dropped %lu messages, shared memory ring "
+                "was full\n", (unsigned long)nc_shm.header->dropped);
+        }
+        nc_shmring_finish(&nc_shm);
+    }
 }
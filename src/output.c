@@ -0,0 +1,243 @@
+/*
+    Copyright (c) 2013 Insollo Entertainment, LLC.  All rights reserved.
+
+    Permission is hereby granted, free of charge, to any person obtaining a copy
+    of this software and associated documentation files (the "Software"),
+    to deal in the Software without restriction, including without limitation
+    the rights to use, copy, modify, merge, publish, distribute, sublicense,
+    and/or sell copies of the Software, and to permit persons to whom
+    the Software is furnished to do so, subject to the following conditions:
+
+    The above copyright notice and this permission notice shall be included
+    in all copies or substantial portions of the Software.
+
+    THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+    IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+    FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL
+    THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+    LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+    FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS
+    IN THE SOFTWARE.
+*/
+
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <time.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <sys/stat.h>
+
+#include "output.h"
+#include "ring.h"
+
+#define NC_FILEWRITER_RING (16 << 20)  /*  bytes, power of two  */
+
+struct nc_filewriter {
+    /*  Advanced by the producer  */
+    unsigned long head;
+    char pad1[NC_CACHELINE - sizeof(unsigned long)];
+    unsigned long boundary;  /*  head at the end of last complete message  */
+    char pad2[NC_CACHELINE - sizeof(unsigned long)];
+    /*  Advanced by the writer thread  */
+    unsigned long tail;
+    char pad3[NC_CACHELINE - sizeof(unsigned long)];
+    int finished;
+
+    char *ring;
+    pthread_t thread;
+
+    /*  Owned by the writer thread  */
+    char *path;
+    char *rotated_path;
+    int rotated_index;
+    int fd;
+    long rotate_size;
+    double rotate_interval;
+    unsigned long written;
+    double opened_at;
+};
+
+static void nc_filewriter_error(struct nc_filewriter *writer, char *message) {
+    fprintf(stderr, "%s ``%s'': %s\n", message, writer->path, strerror(errno));
+    exit(3);
+}
+
+static double nc_filewriter_time() {
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ((double)ts.tv_sec) + ts.tv_nsec*0.000000001;
+}
+
+static void nc_filewriter_open(struct nc_filewriter *writer) {
+    writer->fd = open(writer->path, O_WRONLY|O_CREAT|O_APPEND, 0666);
+    if(writer->fd < 0) {
+        nc_filewriter_error(writer, "Can't open output file");
+    }
+    writer->written = 0;
+    writer->opened_at = nc_filewriter_time();
+}
+
+/*  Moves current file to PATH.N, where N is the first index not used yet  */
+static void nc_filewriter_rotate(struct nc_filewriter *writer) {
+    struct stat st;
+
+    if(close(writer->fd) < 0) {
+        nc_filewriter_error(writer, "Can't close output file");
+    }
+    do {
+        writer->rotated_index += 1;
+        sprintf(writer->rotated_path, "%s.%d",
+                writer->path, writer->rotated_index);
+    } while(stat(writer->rotated_path, &st) == 0);
+    if(rename(writer->path, writer->rotated_path) < 0) {
+        nc_filewriter_error(writer, "Can't rotate output file");
+    }
+    nc_filewriter_open(writer);
+}
+
+static int nc_filewriter_rotation_due(struct nc_filewriter *writer) {
+    if(!writer->written) {
+        return 0;  /*  don't produce empty files  */
+    }
+    if(writer->rotate_size > 0 && writer->written >= writer->rotate_size) {
+        return 1;
+    }
+    return writer->rotate_interval > 0 &&
+        nc_filewriter_time() - writer->opened_at >= writer->rotate_interval;
+}
+
+static void *nc_filewriter_thread(void *arg) {
+    struct nc_filewriter *writer = arg;
+    unsigned long tail = 0;
+    unsigned long limit;
+    unsigned long boundary = 0;
+    unsigned long offset;
+    long chunk;
+    int rotating = 0;
+    int spins = 0;
+
+    for(;;) {
+        limit = nc_load(&writer->head);
+        /*  The boundary is taken once, when rotation gets due. On a busy
+            feed the producer moves it on before the writer reaches it  */
+        if(!rotating && nc_filewriter_rotation_due(writer)) {
+            boundary = nc_load(&writer->boundary);
+            rotating = boundary >= tail;  /*  else wait for the message end  */
+        }
+        if(rotating && boundary == tail) {
+            nc_filewriter_rotate(writer);
+            rotating = 0;
+        } else if(rotating) {
+            limit = boundary;  /*  finish the message, then rotate  */
+        }
+        if(tail == limit) {
+            if(__atomic_load_n(&writer->finished, __ATOMIC_ACQUIRE) &&
+               tail == nc_load(&writer->head)) {
+                return NULL;
+            }
+            nc_backoff(&spins);
+            continue;
+        }
+        spins = 0;
+
+        /*  Everything available up to the end of the ring in one write  */
+        offset = tail & (NC_FILEWRITER_RING - 1);
+        chunk = limit - tail;
+        if(chunk > NC_FILEWRITER_RING - offset) {
+            chunk = NC_FILEWRITER_RING - offset;
+        }
+        chunk = write(writer->fd, writer->ring + offset, chunk);
+        if(chunk < 0) {
+            if(errno == EINTR) {
+                continue;
+            }
+            nc_filewriter_error(writer, "Can't write output file");
+        }
+        writer->written += chunk;
+        tail += chunk;
+        nc_store(&writer->tail, tail);
+    }
+}
+
+struct nc_filewriter *nc_filewriter_start(const char *path,
+    long rotate_size, double rotate_interval)
+{
+    struct nc_filewriter *writer;
+    int rc;
+
+    writer = calloc(1, sizeof(struct nc_filewriter));
+    if(!writer) {
+        fprintf(stderr, "Can't allocate output file writer\n");
+        exit(3);
+    }
+    writer->ring = malloc(NC_FILEWRITER_RING);
+    writer->path = malloc(strlen(path) + 1);
+    writer->rotated_path = malloc(strlen(path) + 16);
+    if(!writer->ring || !writer->path || !writer->rotated_path) {
+        fprintf(stderr, "Can't allocate output file writer\n");
+        exit(3);
+    }
+    strcpy(writer->path, path);
+    writer->rotate_size = rotate_size;
+    writer->rotate_interval = rotate_interval;
+    nc_filewriter_open(writer);
+
+    rc = pthread_create(&writer->thread, NULL, nc_filewriter_thread, writer);
+    if(rc) {
+        errno = rc;
+        nc_filewriter_error(writer, "Can't start writer thread for");
+    }
+    return writer;
+}
+
+void nc_filewriter_put(struct nc_filewriter *writer,
+                       const char *data, int len)
+{
+    unsigned long head = writer->head;
+    unsigned long offset;
+    unsigned long chunk;
+    int spins = 0;
+
+    while(len > 0) {
+        chunk = NC_FILEWRITER_RING - (head - nc_load(&writer->tail));
+        if(!chunk) {
+            nc_backoff(&spins);  /*  disk can't keep up  */
+            continue;
+        }
+        spins = 0;
+        offset = head & (NC_FILEWRITER_RING - 1);
+        if(chunk > NC_FILEWRITER_RING - offset) {
+            chunk = NC_FILEWRITER_RING - offset;
+        }
+        if(chunk > len) {
+            chunk = len;
+        }
+        memcpy(writer->ring + offset, data, chunk);
+        data += chunk;
+        len -= chunk;
+        head += chunk;
+        nc_store(&writer->head, head);
+    }
+}
+
+void nc_filewriter_message_end(struct nc_filewriter *writer) {
+    nc_store(&writer->boundary, writer->head);
+}
+
+/*  Writes out everything that is buffered and closes the file  */
+void nc_filewriter_stop(struct nc_filewriter *writer) {
+    __atomic_store_n(&writer->finished, 1, __ATOMIC_RELEASE);
+    pthread_join(writer->thread, NULL);
+    if(close(writer->fd) < 0) {
+        nc_filewriter_error(writer, "Can't close output file");
+    }
+    free(writer->ring);
+    free(writer->path);
+    free(writer->rotated_path);
+    free(writer);
+}
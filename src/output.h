@@ -0,0 +1,41 @@
+/*
+    Copyright (c) 2013 Insollo Entertainment, LLC.  All rights reserved.
+
+    Permission is hereby granted, free of charge, to any person obtaining a copy
+    of this software and associated documentation files (the "Software"),
+    to deal in the Software without restriction, including without limitation
+    the rights to use, copy, modify, merge, publish, distribute, sublicense,
+    and/or sell copies of the Software, and to permit persons to whom
+    the Software is furnished to do so, subject to the following conditions:
+
+    The above copyright notice and this permission notice shall be included
+    in all copies or substantial portions of the Software.
+
+    THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+    IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+    FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL
+    THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+    LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+    FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS
+    IN THE SOFTWARE.
+*/
+
+
+#ifndef NC_OUTPUT_HEADER
+#define NC_OUTPUT_HEADER
+
+/*  Writer of the --output file. Received data is copied into a ring buffer
+    and a dedicated thread writes it to disk in large chunks, so slow disk
+    never blocks the receiving thread unless the ring fills up. The file
+    is rotated at message boundaries when it grows over ``rotate_size``
+    bytes or gets older than ``rotate_interval`` seconds (zero disables)  */
+struct nc_filewriter;
+
+struct nc_filewriter *nc_filewriter_start(const char *path,
+    long rotate_size, double rotate_interval);
+void nc_filewriter_put(struct nc_filewriter *writer,
+                       const char *data, int len);
+void nc_filewriter_message_end(struct nc_filewriter *writer);
+void nc_filewriter_stop(struct nc_filewriter *writer);
+
+#endif  /* NC_OUTPUT_HEADER */
@@ -0,0 +1,59 @@
+/*
+    Copyright (c) 2013 Insollo Entertainment, LLC.  All rights reserved.
+
+    Permission is hereby granted, free of charge, to any person obtaining a copy
+    of this software and associated documentation files (the "Software"),
+    to deal in the Software without restriction, including without limitation
+    the rights to use, copy, modify, merge, publish, distribute, sublicense,
+    and/or sell copies of the Software, and to permit persons to whom
+    the Software is furnished to do so, subject to the following conditions:
+
+    The above copyright notice and this permission notice shall be included
+    in all copies or substantial portions of the Software.
+
+    THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+    IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+    FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL
+    THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+    LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+    FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS
+    IN THE SOFTWARE.
+*/
+
+
+#ifndef NC_RING_HEADER
+#define NC_RING_HEADER
+
+#include <sched.h>
+#include <time.h>
+
+/*  Helpers for lock-free single-producer/single-consumer rings. Every ring
+    index is written by one thread only and read by the other, so acquire
+    loads and release stores are the only synchronization needed  */
+
+#define NC_CACHELINE 64
+
+static inline unsigned long nc_load(unsigned long *ptr) {
+    return __atomic_load_n(ptr, __ATOMIC_ACQUIRE);
+}
+
+static inline void nc_store(unsigned long *ptr, unsigned long value) {
+    __atomic_store_n(ptr, value, __ATOMIC_RELEASE);
+}
+
+/*  Waits a bit for the other side of a ring. Spins first, then yields, then
+    sleeps, so an idle ring doesn't eat CPU  */
+static inline void nc_backoff(int *spins) {
+    struct timespec ts = {0, 100000};
+
+    if(*spins < 100) {
+        *spins += 1;
+    } else if(*spins < 200) {
+        *spins += 1;
+        sched_yield();
+    } else {
+        nanosleep(&ts, NULL);
+    }
+}
+
+#endif  /* NC_RING_HEADER */
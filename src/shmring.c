@@ -0,0 +1,116 @@
+/*
+    Copyright (c) 2013 Insollo Entertainment, LLC.  All rights reserved.
+
+    Permission is hereby granted, free of charge, to any person obtaining a copy
+    of this software and associated documentation files (the "Software"),
+    to deal in the Software without restriction, including without limitation
+    the rights to use, copy, modify, merge, publish, distribute, sublicense,
+    and/or sell copies of the Software, and to permit persons to whom
+    the Software is furnished to do so, subject to the following conditions:
+
+    The above copyright notice and this permission notice shall be included
+    in all copies or substantial portions of the Software.
+
+    THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+    IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+    FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL
+    THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+    LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+    FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS
+    IN THE SOFTWARE.
+*/
+
+
+#include "shmring.h"
+
+int nc_shmring_create(struct nc_shmring *ring, const char *name,
+                      uint64_t size)
+{
+    char path[NC_SHMRING_PATH];
+    uint64_t area;
+    void *map;
+    int fd;
+    int err;
+
+    area = 4096;
+    while(area < size) {
+        area *= 2;
+    }
+
+    /*  Consumers of a previous ring keep their mapping of the old object,
+        it's unlinked and never truncated under them  */
+    name = nc_shmring_path(path, name);
+    if(!name) {
+        return -1;
+    }
+    if(shm_unlink(name) < 0 && errno != ENOENT) {
+        return -1;
+    }
+    fd = shm_open(name, O_RDWR | O_CREAT | O_EXCL, 0644);
+    if(fd < 0) {
+        return -1;
+    }
+    if(ftruncate(fd, NC_SHMRING_DATA + area) < 0) {
+        err = errno;
+        close(fd);
+        errno = err;
+        return -1;
+    }
+    map = mmap(NULL, NC_SHMRING_DATA + area, PROT_READ | PROT_WRITE,
+               MAP_SHARED, fd, 0);
+    err = errno;
+    close(fd);
+    if(map == MAP_FAILED) {
+        errno = err;
+        return -1;
+    }
+    ring->header = map;
+    ring->data = (char *)map + NC_SHMRING_DATA;
+    ring->mask = area - 1;
+    ring->mapped = NC_SHMRING_DATA + area;
+    ring->next = 0;
+    memset(ring->header, 0, sizeof(struct nc_shmring_header));
+    ring->header->size = area;
+    ring->header->version = NC_SHMRING_VERSION;
+    __atomic_store_n(&ring->header->magic, NC_SHMRING_MAGIC,
+                     __ATOMIC_RELEASE);
+    return 0;
+}
+
+int nc_shmring_put(struct nc_shmring *ring, const char *data, uint32_t len) {
+    uint64_t head;
+    uint64_t tail;
+    uint64_t need;
+    uint64_t skip;
+    uint64_t pos;
+    uint32_t wrap = NC_SHMRING_WRAP;
+
+    head = ring->header->head;
+    pos = head & ring->mask;
+    need = nc_shmring_record(len);
+    skip = ring->header->size - pos < need ? ring->header->size - pos : 0;
+    tail = __atomic_load_n(&ring->header->tail, __ATOMIC_ACQUIRE);
+    if(need > ring->header->size ||
+       head + skip + need - tail > ring->header->size) {
+        return -1;
+    }
+    if(skip) {
+        memcpy(ring->data + pos, &wrap, 4);
+        pos = 0;
+    }
+    memcpy(ring->data + pos, &len, 4);
+    memcpy(ring->data + pos + 4, data, len);
+    __atomic_store_n(&ring->header->head, head + skip + need,
+                     __ATOMIC_RELEASE);
+    return 0;
+}
+
+void nc_shmring_drop(struct nc_shmring *ring) {
+    __atomic_store_n(&ring->header->dropped, ring->header->dropped + 1,
+                     __ATOMIC_RELAXED);
+}
+
+void nc_shmring_finish(struct nc_shmring *ring) {
+    __atomic_store_n(&ring->header->closed, 1, __ATOMIC_RELEASE);
+    munmap(ring->header, ring->mapped);
+}
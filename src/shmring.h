@@ -0,0 +1,233 @@
+/*
+    Copyright (c) 2013 Insollo Entertainment, LLC.  All rights reserved.
+
+    Permission is hereby granted, free of charge, to any person obtaining a copy
+    of this software and associated documentation files (the "Software"),
+    to deal in the Software without restriction, including without limitation
+    the rights to use, copy, modify, merge, publish, distribute, sublicense,
+    and/or sell copies of the Software, and to permit persons to whom
+    the Software is furnished to do so, subject to the following conditions:
+
+    The above copyright notice and this permission notice shall be included
+    in all copies or substantial portions of the Software.
+
+    THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+    IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+    FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL
+    THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+    LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+    FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS
+    IN THE SOFTWARE.
+*/
+
+
+
+#ifndef NC_SHMRING_HEADER
+#define NC_SHMRING_HEADER
+
+/*  Shared-memory ring written by ``nanocat --shm-ring NAME``. It's a POSIX
+    shared memory object (/dev/shm/NAME on Linux) with a header followed by
+    a power-of-two data area. Every message is a 4-byte length in host
+    byte order and the body, padded to 8 bytes. A length of
+    NC_SHMRING_WRAP means the rest of the area is unused and the next
+    message is at its start, so a body is never split.
+
+    There is one producer and one consumer. Consumer reads messages in
+    place, without copying, using the functions below:
+
+        struct nc_shmring ring;
+        const char *msg;
+        uint32_t len;
+
+        if(nc_shmring_open(&ring, "feed") < 0)
+            ...
+        for(;;) {
+            msg = nc_shmring_next(&ring, &len);
+            if(!msg) {
+                if(nc_shmring_closed(&ring))
+                    break;
+                usleep(100);
+                continue;
+            }
+            ... use len bytes at msg ...
+            nc_shmring_release(&ring);
+        }
+        nc_shmring_close(&ring);
+
+    This file has no dependencies other than libc (and librt for shm_open
+    on older glibc), it's enough to copy it.  */
+
+#include <stdint.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#define NC_SHMRING_MAGIC 0x4e435247u  /*  "NCRG"  */
+#define NC_SHMRING_VERSION 1
+#define NC_SHMRING_DATA 256  /*  offset of the data area  */
+#define NC_SHMRING_WRAP 0xffffffffu
+
+struct nc_shmring_header {
+    uint32_t magic;
+    uint32_t version;
+    uint64_t size;  /*  of the data area  */
+    uint64_t dropped;  /*  messages dropped by producer, ring being full  */
+    uint32_t closed;  /*  producer has exited  */
+    char pad1[36];
+    uint64_t head;  /*  bytes ever written, advanced by the producer  */
+    char pad2[56];
+    uint64_t tail;  /*  bytes ever consumed, advanced by the consumer  */
+    char pad3[56];
+};
+
+struct nc_shmring {
+    struct nc_shmring_header *header;
+    char *data;
+    uint64_t mask;
+    uint64_t next;  /*  tail after the message returned by next()  */
+    size_t mapped;
+};
+
+/*  Space taken by a message of ``len`` bytes  */
+static inline uint64_t nc_shmring_record(uint32_t len) {
+    return ((uint64_t)len + 4 + 7) & ~(uint64_t)7;
+}
+
+/*  Size of the buffer for nc_shmring_path()  */
+#define NC_SHMRING_PATH 256
+
+/*  POSIX wants shared memory names to start with a slash. Returns
+    ``name`` or the slashed copy in ``path``, or NULL if it's too long  */
+static inline const char *nc_shmring_path(char *path, const char *name) {
+    if(name[0] == '/') {
+        return name;
+    }
+    if(strlen(name) + 2 > NC_SHMRING_PATH) {
+        errno = ENAMETOOLONG;
+        return NULL;
+    }
+    path[0] = '/';
+    strcpy(path + 1, name);
+    return path;
+}
+
+static inline int nc_shmring_shm_open(const char *name, int flags,
+                                      mode_t mode)
+{
+    char path[NC_SHMRING_PATH];
+
+    name = nc_shmring_path(path, name);
+    if(!name) {
+        return -1;
+    }
+    return shm_open(name, flags, mode);
+}
+
+/*  Returns 0, or -1 and sets errno  */
+static inline int nc_shmring_open(struct nc_shmring *ring, const char *name) {
+    struct stat st;
+    void *map;
+    int fd;
+
+    fd = nc_shmring_shm_open(name, O_RDWR, 0);
+    if(fd < 0) {
+        return -1;
+    }
+    if(fstat(fd, &st) < 0) {
+        close(fd);
+        return -1;
+    }
+    if(st.st_size < NC_SHMRING_DATA) {
+        close(fd);
+        errno = EINVAL;
+        return -1;
+    }
+    map = mmap(NULL, st.st_size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    close(fd);
+    if(map == MAP_FAILED) {
+        return -1;
+    }
+    ring->header = map;
+    ring->data = (char *)map + NC_SHMRING_DATA;
+    ring->mapped = st.st_size;
+    if(ring->header->magic != NC_SHMRING_MAGIC ||
+       ring->header->version != NC_SHMRING_VERSION ||
+       ring->header->size + NC_SHMRING_DATA != (uint64_t)st.st_size) {
+        munmap(map, st.st_size);
+        errno = EINVAL;
+        return -1;
+    }
+    ring->mask = ring->header->size - 1;
+    ring->next = ring->header->tail;
+    return 0;
+}
+
+/*  Returns the next message and its length, or NULL if there is none
+    yet. The message stays valid until nc_shmring_release()  */
+static inline const char *nc_shmring_next(struct nc_shmring *ring,
+                                          uint32_t *len)
+{
+    uint64_t tail;
+    uint64_t head;
+    uint32_t size;
+
+    tail = ring->header->tail;
+    head = __atomic_load_n(&ring->header->head, __ATOMIC_ACQUIRE);
+    while(tail != head) {
+        memcpy(&size, ring->data + (tail & ring->mask), 4);
+        if(size == NC_SHMRING_WRAP) {
+            tail += ring->header->size - (tail & ring->mask);
+            __atomic_store_n(&ring->header->tail, tail, __ATOMIC_RELEASE);
+            continue;
+        }
+        *len = size;
+        ring->next = tail + nc_shmring_record(size);
+        return ring->data + (tail & ring->mask) + 4;
+    }
+    return NULL;
+}
+
+/*  Gives the space of the message returned by nc_shmring_next() back to
+    the producer  */
+static inline void nc_shmring_release(struct nc_shmring *ring) {
+    __atomic_store_n(&ring->header->tail, ring->next, __ATOMIC_RELEASE);
+}
+
+/*  Whether the producer has exited. Messages may still be in the ring,
+    so check after nc_shmring_next() returns NULL  */
+static inline int nc_shmring_closed(struct nc_shmring *ring) {
+    return __atomic_load_n(&ring->header->closed, __ATOMIC_ACQUIRE) &&
+        ring->header->tail ==
+            __atomic_load_n(&ring->header->head, __ATOMIC_ACQUIRE);
+}
+
+static inline uint64_t nc_shmring_dropped(struct nc_shmring *ring) {
+    return __atomic_load_n(&ring->header->dropped, __ATOMIC_RELAXED);
+}
+
+static inline void nc_shmring_close(struct nc_shmring *ring) {
+    munmap(ring->header, ring->mapped);
+}
+
+/*  Producer side, implemented in shmring.c  */
+
+/*  Creates the ring anew, ``size`` is rounded up to a power of two.
+    Returns 0, or -1 and sets errno  */
+int nc_shmring_create(struct nc_shmring *ring, const char *name,
+                      uint64_t size);
+
+/*  Returns 0, or -1 if there is no room for the message now (or ever, if
+    it's larger than the ring)  */
+int nc_shmring_put(struct nc_shmring *ring, const char *data, uint32_t len);
+
+/*  Counts a message the producer didn't wait to put  */
+void nc_shmring_drop(struct nc_shmring *ring);
+
+/*  Marks the ring closed and unmaps it, the ring is left for consumers to
+    drain  */
+void nc_shmring_finish(struct nc_shmring *ring);
+
+#endif  /* NC_SHMRING_HEADER */
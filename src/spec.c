@@ -0,0 +1,194 @@
+/*
+    Copyright (c) 2013 Insollo Entertainment, LLC.  All rights reserved.
+
+    Permission is hereby granted, free of charge, to any person obtaining a copy
+    of this software and associated documentation files (the "Software"),
+    to deal in the Software without restriction, including without limitation
+    the rights to use, copy, modify, merge, publish, distribute, sublicense,
+    and/or sell copies of the Software, and to permit persons to whom
+    the Software is furnished to do so, subject to the following conditions:
+
+    The above copyright notice and this permission notice shall be included
+    in all copies or substantial portions of the Software.
+
+    THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+    IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+    FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL
+    THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+    LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+    FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS
+    IN THE SOFTWARE.
+*/
+
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+
+#include "spec.h"
+
+static void nc_spec_memory_error() {
+    fprintf(stderr, "Memory error while reading spec file\n");
+    abort();
+}
+
+static int nc_spec_isspace(char c) {
+    return c == ' ' || c == '\t' || c == '\r';
+}
+
+/*  Splits the line into arguments in place. Returns number of arguments
+    or -1 if a quote is not terminated  */
+static int nc_spec_split(char *line, char **argv) {
+    char *src;
+    char *dst;
+    char quote;
+    int argc;
+
+    src = line;
+    dst = line;
+    argc = 0;
+    for(;;) {
+        while(nc_spec_isspace(*src)) {
+            ++src;
+        }
+        if(!*src) {
+            return argc;
+        }
+        argv[argc++] = dst;
+        quote = 0;
+        while(*src && (quote || !nc_spec_isspace(*src))) {
+            if(quote && *src == quote) {
+                quote = 0;
+            } else if(!quote && (*src == '\'' || *src == '"')) {
+                quote = *src;
+            } else {
+                *dst++ = *src;
+            }
+            ++src;
+        }
+        if(quote) {
+            return -1;
+        }
+        if(*src) {
+            ++src;
+        }
+        *dst++ = '\0';
+    }
+}
+
+static char *nc_spec_load(const char *path) {
+    FILE *file;
+    char *data;
+    size_t len;
+    size_t size;
+
+    file = fopen(path, "r");
+    if(!file) {
+        fprintf(stderr, "Error opening file ``%s'': %s\n",
+            path, strerror(errno));
+        exit(2);
+    }
+    len = 0;
+    size = 4096;
+    data = malloc(size);
+    if(!data) {
+        nc_spec_memory_error();
+    }
+    for(;;) {
+        len += fread(data + len, 1, size - len - 1, file);
+        if(ferror(file)) {
+            fprintf(stderr, "Error reading file ``%s'': %s\n",
+                path, strerror(errno));
+            exit(2);
+        }
+        if(feof(file)) {
+            break;
+        }
+        size *= 2;
+        data = realloc(data, size);
+        if(!data) {
+            nc_spec_memory_error();
+        }
+    }
+    fclose(file);
+    data[len] = '\0';
+    return data;
+}
+
+struct nc_spec *nc_spec_read(const char *path) {
+    struct nc_spec *spec;
+    struct nc_spec_line *line;
+    char *cur;
+    char *end;
+    char **argv;
+    int argc;
+    int lineno;
+
+    spec = malloc(sizeof(struct nc_spec));
+    if(!spec) {
+        nc_spec_memory_error();
+    }
+    spec->data = nc_spec_load(path);
+    spec->num = 0;
+    spec->lines = NULL;
+
+    cur = spec->data;
+    for(lineno = 1; *cur; ++lineno, cur = end) {
+        end = strchr(cur, '\n');
+        if(end) {
+            *end++ = '\0';
+        } else {
+            end = cur + strlen(cur);
+        }
+
+        /*  There are no more arguments than every second character  */
+        argv = malloc(sizeof(char *) * (strlen(cur) / 2 + 3));
+        if(!argv) {
+            nc_spec_memory_error();
+        }
+        argc = nc_spec_split(cur, argv + 1);
+        if(argc < 0) {
+            fprintf(stderr, "%s:%d: Unterminated quote\n", path, lineno);
+            exit(2);
+        }
+        if(!argc || argv[1][0] == '#') {
+            free(argv);
+            continue;
+        }
+
+        argv[0] = malloc(strlen(path) + 16);
+        if(!argv[0]) {
+            nc_spec_memory_error();
+        }
+        sprintf(argv[0], "%s:%d", path, lineno);
+        argv[argc + 1] = NULL;
+
+        spec->lines = realloc(spec->lines,
+            sizeof(struct nc_spec_line) * (spec->num + 1));
+        if(!spec->lines) {
+            nc_spec_memory_error();
+        }
+        line = &spec->lines[spec->num++];
+        line->argc = argc + 1;
+        line->argv = argv;
+    }
+
+    if(!spec->num) {
+        fprintf(stderr, "No sockets declared in ``%s''\n", path);
+        exit(2);
+    }
+    return spec;
+}
+
+void nc_spec_free(struct nc_spec *spec) {
+    int i;
+
+    for(i = 0; i < spec->num; ++i) {
+        free(spec->lines[i].argv[0]);
+        free(spec->lines[i].argv);
+    }
+    free(spec->lines);
+    free(spec->data);
+    free(spec);
+}
@@ -0,0 +1,45 @@
+/*
+    Copyright (c) 2013 Insollo Entertainment, LLC.  All rights reserved.
+
+    Permission is hereby granted, free of charge, to any person obtaining a copy
+    of this software and associated documentation files (the "Software"),
+    to deal in the Software without restriction, including without limitation
+    the rights to use, copy, modify, merge, publish, distribute, sublicense,
+    and/or sell copies of the Software, and to permit persons to whom
+    the Software is furnished to do so, subject to the following conditions:
+
+    The above copyright notice and this permission notice shall be included
+    in all copies or substantial portions of the Software.
+
+    THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+    IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+    FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL
+    THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+    LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+    FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS
+    IN THE SOFTWARE.
+*/
+
+
+#ifndef NC_SPEC_HEADER
+#define NC_SPEC_HEADER
+
+/*  A --spec file declares one socket per line with the same options as
+    the command-line. Arguments are separated by whitespace and may be
+    quoted with single or double quotes. Empty lines and lines starting
+    with ``#'' are skipped  */
+struct nc_spec_line {
+    int argc;
+    char **argv;  /*  argv[0] is ``FILE:LINE'' to prefix error messages  */
+};
+
+struct nc_spec {
+    int num;
+    struct nc_spec_line *lines;
+    char *data;
+};
+
+struct nc_spec *nc_spec_read(const char *path);
+void nc_spec_free(struct nc_spec *spec);
+
+#endif  /* NC_SPEC_HEADER */
@@ -0,0 +1,303 @@
+/*
+    Copyright (c) 2013 Insollo Entertainment, LLC.  All rights reserved.
+
+    Permission is hereby granted, free of charge, to any person obtaining a copy
+    of this software and associated documentation files (the "Software"),
+    to deal in the Software without restriction, including without limitation
+    the rights to use, copy, modify, merge, publish, distribute, sublicense,
+    and/or sell copies of the Software, and to permit persons to whom
+    the Software is furnished to do so, subject to the following conditions:
+
+    The above copyright notice and this permission notice shall be included
+    in all copies or substantial portions of the Software.
+
+    THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+    IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+    FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL
+    THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+    LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+    FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS
+    IN THE SOFTWARE.
+*/
+
+
+#include <stdlib.h>
+#include <string.h>
+
+#include "topk.h"
+#include "hash.h"
+
+/*  With 4 rows of 4096 cells an estimate exceeds the real count by more
+    than 0.07% of the total with probability under 2%  */
+#define NC_TOPK_DEPTH 4
+#define NC_TOPK_WIDTH 4096
+
+struct nc_topk_cell {
+    uint64_t messages;
+    uint64_t bytes;
+};
+
+struct nc_topk_entry {
+    uint64_t hash;
+    uint64_t estimate;
+    int slot;  /*  in nc_topk_heap.slots  */
+    int keylen;
+    char key[NC_TOPK_MAXKEY];
+};
+
+/*  Min-heap by estimate, the root is the first one to be replaced. Keys
+    are found by a linear probing hash table of heap indices plus one (zero
+    is an empty slot), at least twice as large as the heap  */
+struct nc_topk_heap {
+    int num;
+    struct nc_topk_entry *entries;
+    unsigned mask;
+    int *slots;
+};
+
+struct nc_topk {
+    int k;
+    struct nc_topk_heap by_messages;
+    struct nc_topk_heap by_bytes;
+    struct nc_topk_cell cells[NC_TOPK_DEPTH][NC_TOPK_WIDTH];
+};
+
+static int nc_topk_heap_init(struct nc_topk_heap *heap, int k) {
+    unsigned size;
+
+    size = 2;
+    while(size < 2 * (unsigned)k) {
+        size *= 2;
+    }
+    heap->mask = size - 1;
+    heap->entries = calloc(k, sizeof(struct nc_topk_entry));
+    heap->slots = calloc(size, sizeof(int));
+    return heap->entries && heap->slots ? 0 : -1;
+}
+
+struct nc_topk *nc_topk_new(int k) {
+    struct nc_topk *topk;
+
+    topk = calloc(1, sizeof(struct nc_topk));
+    if(!topk) {
+        return NULL;
+    }
+    topk->k = k;
+    if(nc_topk_heap_init(&topk->by_messages, k) < 0 ||
+       nc_topk_heap_init(&topk->by_bytes, k) < 0) {
+        nc_topk_free(topk);
+        return NULL;
+    }
+    return topk;
+}
+
+void nc_topk_free(struct nc_topk *topk) {
+    free(topk->by_messages.entries);
+    free(topk->by_messages.slots);
+    free(topk->by_bytes.entries);
+    free(topk->by_bytes.slots);
+    free(topk);
+}
+
+void nc_topk_reset(struct nc_topk *topk) {
+    memset(topk->cells, 0, sizeof(topk->cells));
+    topk->by_messages.num = 0;
+    memset(topk->by_messages.slots, 0,
+           (topk->by_messages.mask + 1) * sizeof(int));
+    topk->by_bytes.num = 0;
+    memset(topk->by_bytes.slots, 0,
+           (topk->by_bytes.mask + 1) * sizeof(int));
+}
+
+/*  Returns the slot of the key, or the empty slot where it belongs  */
+static int nc_topk_find(struct nc_topk_heap *heap, uint64_t hash,
+                        const char *key, int keylen)
+{
+    struct nc_topk_entry *entry;
+    unsigned i;
+
+    for(i = hash & heap->mask; heap->slots[i];
+        i = (i + 1) & heap->mask) {
+        entry = &heap->entries[heap->slots[i] - 1];
+        if(entry->hash == hash && entry->keylen == keylen &&
+           !memcmp(entry->key, key, keylen)) {
+            break;
+        }
+    }
+    return (int)i;
+}
+
+/*  Empties the slot, moving back the keys that probed past it  */
+static void nc_topk_unlink(struct nc_topk_heap *heap, int slot) {
+    struct nc_topk_entry *entry;
+    unsigned hole;
+    unsigned home;
+    unsigned i;
+
+    hole = slot;
+    heap->slots[hole] = 0;
+    for(i = (hole + 1) & heap->mask; heap->slots[i];
+        i = (i + 1) & heap->mask) {
+        entry = &heap->entries[heap->slots[i] - 1];
+        home = entry->hash & heap->mask;
+        if(((i - home) & heap->mask) >= ((i - hole) & heap->mask)) {
+            heap->slots[hole] = heap->slots[i];
+            heap->slots[i] = 0;
+            entry->slot = hole;
+            hole = i;
+        }
+    }
+}
+
+static void nc_topk_swap(struct nc_topk_heap *heap, int a, int b) {
+    struct nc_topk_entry tmp;
+
+    tmp = heap->entries[a];
+    heap->entries[a] = heap->entries[b];
+    heap->entries[b] = tmp;
+    heap->slots[heap->entries[a].slot] = a + 1;
+    heap->slots[heap->entries[b].slot] = b + 1;
+}
+
+static void nc_topk_sift_up(struct nc_topk_heap *heap, int i) {
+    while(i > 0 && heap->entries[i].estimate <
+                   heap->entries[(i - 1) / 2].estimate) {
+        nc_topk_swap(heap, i, (i - 1) / 2);
+        i = (i - 1) / 2;
+    }
+}
+
+static void nc_topk_sift_down(struct nc_topk_heap *heap, int i) {
+    int child;
+
+    for(;;) {
+        child = 2 * i + 1;
+        if(child >= heap->num) {
+            break;
+        }
+        if(child + 1 < heap->num && heap->entries[child + 1].estimate <
+                                    heap->entries[child].estimate) {
+            child += 1;
+        }
+        if(heap->entries[i].estimate <= heap->entries[child].estimate) {
+            break;
+        }
+        nc_topk_swap(heap, i, child);
+        i = child;
+    }
+}
+
+/*  Estimates only grow, so a key already in the heap moves down  */
+static void nc_topk_offer(struct nc_topk_heap *heap, int k, uint64_t hash,
+                          const char *key, int keylen, uint64_t estimate)
+{
+    struct nc_topk_entry *entry;
+    int slot;
+    int i;
+
+    slot = nc_topk_find(heap, hash, key, keylen);
+    if(heap->slots[slot]) {
+        i = heap->slots[slot] - 1;
+        heap->entries[i].estimate = estimate;
+        nc_topk_sift_down(heap, i);
+        return;
+    }
+    if(heap->num < k) {
+        i = heap->num++;
+    } else if(estimate > heap->entries[0].estimate) {
+        i = 0;
+        nc_topk_unlink(heap, heap->entries[0].slot);
+        slot = nc_topk_find(heap, hash, key, keylen);
+    } else {
+        return;
+    }
+    heap->slots[slot] = i + 1;
+    entry = &heap->entries[i];
+    entry->slot = slot;
+    entry->hash = hash;
+    entry->estimate = estimate;
+    entry->keylen = keylen;
+    memcpy(entry->key, key, keylen);
+    if(i) {
+        nc_topk_sift_up(heap, i);
+    } else {
+        nc_topk_sift_down(heap, i);
+    }
+}
+
+void nc_topk_add(struct nc_topk *topk, const char *key, int keylen,
+                 uint64_t bytes)
+{
+    struct nc_topk_cell *cell;
+    uint64_t hash;
+    uint64_t messages_est;
+    uint64_t bytes_est;
+    uint32_t h1;
+    uint32_t h2;
+    int i;
+
+    if(keylen > NC_TOPK_MAXKEY) {
+        keylen = NC_TOPK_MAXKEY;
+    }
+    hash = nc_hash(key, keylen);
+
+    /*  Rows are indexed by h1 + i*h2 (Kirsch-Mitzenmacher), so a single
+        hash is enough  */
+    h1 = (uint32_t)hash;
+    h2 = (uint32_t)(hash >> 32) | 1;
+    messages_est = UINT64_MAX;
+    bytes_est = UINT64_MAX;
+    for(i = 0; i < NC_TOPK_DEPTH; ++i) {
+        cell = &topk->cells[i][(h1 + i * h2) % NC_TOPK_WIDTH];
+        cell->messages += 1;
+        cell->bytes += bytes;
+        if(cell->messages < messages_est) {
+            messages_est = cell->messages;
+        }
+        if(cell->bytes < bytes_est) {
+            bytes_est = cell->bytes;
+        }
+    }
+    nc_topk_offer(&topk->by_messages, topk->k, hash, key, keylen,
+                  messages_est);
+    nc_topk_offer(&topk->by_bytes, topk->k, hash, key, keylen, bytes_est);
+}
+
+static int nc_topk_entry_cmp(const void *a, const void *b) {
+    const struct nc_topk_entry *ea = a;
+    const struct nc_topk_entry *eb = b;
+
+    if(ea->estimate != eb->estimate) {
+        return ea->estimate < eb->estimate ? -1 : 1;
+    }
+    return 0;
+}
+
+/*  Array sorted in ascending order is still a valid min-heap, so it's
+    sorted in place, slots updated, and printed from the end  */
+static void nc_topk_print_heap(struct nc_topk_heap *heap, FILE *stream,
+                               const char *name, const char *unit)
+{
+    struct nc_topk_entry *entry;
+    int i;
+
+    qsort(heap->entries, heap->num, sizeof(struct nc_topk_entry),
+          nc_topk_entry_cmp);
+    for(i = 0; i < heap->num; ++i) {
+        heap->slots[heap->entries[i].slot] = i + 1;
+    }
+    fprintf(stream, "Top %s by %s:\n", name, unit);
+    for(i = heap->num - 1; i >= 0; --i) {
+        entry = &heap->entries[i];
+        fprintf(stream, "%14llu  %.*s\n",
+            (unsigned long long)entry->estimate, entry->keylen, entry->key);
+    }
+}
+
+void nc_topk_print(struct nc_topk *topk, FILE *stream, const char *name) {
+    if(!topk->by_messages.num) {
+        return;
+    }
+    nc_topk_print_heap(&topk->by_messages, stream, name, "messages");
+    nc_topk_print_heap(&topk->by_bytes, stream, name, "bytes");
+}
@@ -0,0 +1,56 @@
+/*
+    Copyright (c) 2013 Insollo Entertainment, LLC.  All rights reserved.
+
+    Permission is hereby granted, free of charge, to any person obtaining a copy
+    of this software and associated documentation files (the "Software"),
+    to deal in the Software without restriction, including without limitation
+    the rights to use, copy, modify, merge, publish, distribute, sublicense,
+    and/or sell copies of the Software, and to permit persons to whom
+    the Software is furnished to do so, subject to the following conditions:
+
+    The above copyright notice and this permission notice shall be included
+    in all copies or substantial portions of the Software.
+
+    THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+    IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+    FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL
+    THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+    LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+    FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS
+    IN THE SOFTWARE.
+*/
+
+
+
+#ifndef NC_TOPK_HEADER
+#define NC_TOPK_HEADER
+
+#include <stdio.h>
+#include <stdint.h>
+
+/*  Heavy hitters in constant memory: counts of messages and bytes are
+    kept in a count-min sketch, and the keys with the largest estimates in
+    two min-heaps of size ``k`` (by messages and by bytes). Estimates may
+    exceed the real counts but never fall below them. Keys longer than
+    NC_TOPK_MAXKEY are truncated  */
+#define NC_TOPK_MAXKEY 64
+
+/*  Largest ``k`` of nc_topk_new()  */
+#define NC_TOPK_MAX 65536
+
+struct nc_topk;
+
+/*  Returns NULL if out of memory  */
+struct nc_topk *nc_topk_new(int k);
+void nc_topk_free(struct nc_topk *topk);
+void nc_topk_reset(struct nc_topk *topk);
+
+/*  Counts a message of ``bytes`` bytes for the key  */
+void nc_topk_add(struct nc_topk *topk, const char *key, int keylen,
+                 uint64_t bytes);
+
+/*  Prints both rankings, ``name`` describes the keys. Prints nothing if
+    no key was counted  */
+void nc_topk_print(struct nc_topk *topk, FILE *stream, const char *name);
+
+#endif  /* NC_TOPK_HEADER */